@@ -4,6 +4,7 @@
 
 #include "common.h"
 #include "temp.h"
+#include "tlm.h"
 
 
 // OneWire DS18S20, DS18B20, DS1822 Temperature Example
@@ -22,6 +23,12 @@ OneWire oneWire(ONE_WIRE_BUS);
 // Pass our oneWire reference to Dallas Temperature. 
 DallasTemperature sensors(&oneWire);
 
+#define DALLAS_RESOLUTION 12
+#define DALLAS_CONVERSION_MS 750 // at 12 bits, see the datasheet
+
+// Start of the running conversion, see dallas_temp_ready_cpp()
+static unsigned long dallas_request_ms;
+
 // function to print a device address
 void printAddress(DeviceAddress deviceAddress)
 {
@@ -36,9 +43,10 @@ uint8_t dallas_temp_init_cpp(void)
   uint8_t devcount;
   // Start up the library
   PRINTF("Dallas Temperature: Setting up sensors...\n");
-  //sensors.setWaitForConversion(false);
   sensors.begin();
-  sensors.setResolution(12);
+  sensors.setResolution(DALLAS_RESOLUTION);
+  // requestTemperatures() only starts the conversion, temp_task() polls for its end
+  sensors.setWaitForConversion(false);
   devcount = sensors.getDeviceCount();
   PRINTF("Dallas sensors set up, %u devices found.\n", devcount);
   //LED_GREEN_OFF(); 
@@ -48,9 +56,17 @@ uint8_t dallas_temp_init_cpp(void)
 
 void dallas_temp_request_cpp(void)
 {
-  cli();
-  sensors.requestTemperatures();  // issue a global temperature request to all devices on the bus
-  sei();
+  // issue a global temperature request to all devices on the bus and return,
+  // OneWire keeps the interrupts off for the single bit slots only
+  sensors.requestTemperatures();
+  dallas_request_ms = millis();
+}
+
+// Conversion time is given by the resolution (the bus cannot be polled
+// for the end of the conversion with parasite powered devices)
+uint8_t dallas_temp_ready_cpp(void)
+{
+  return millis() - dallas_request_ms >= DALLAS_CONVERSION_MS;
 }
 
 int16_t dallas_temp10_get_last_known_value = TEMP_NA;
@@ -80,11 +96,15 @@ int16_t dallas_temp_print_cpp(void)
       //uint8_t dev_res = sensors.getResolution(dev_addr); //PRINTF("Resolution is %u. ", dev_res);
       
       // print data message
+      if (tlm_is_enabled()) {
+        tlm_temp(TLM_DEV_DS18X20, dev_index, t10);
+        continue;
+      }
       MSG_TMP("LOCAL value='"); temp_print_value(t10); PRINTF("' unit='C' raw='%x' dev_type='DS18x20' dev_index='%u' dev_address='", t10, dev_index);
       printAddress(dev_addr); 
       PRINTF("'\n");      
     } else {
-      LOG_TMP("0 Dallas device index %u is not available.\n", dev_index);
+      LOG_TMP(0, "Dallas device index %u is not available.\n", dev_index);
     }
 
   }
@@ -111,6 +131,11 @@ extern "C" {
     dallas_temp_request_cpp();
   }
 
+  uint8_t dallas_temp_ready(void)
+  {
+    return dallas_temp_ready_cpp();
+  }
+
   int16_t dallas_temp10_get_last_known(void) {
     return dallas_temp10_get_last_known_cpp();
   }
@@ -8,6 +8,7 @@ extern "C" {
 #endif
   
   void dallas_temp_request(void);
+  uint8_t dallas_temp_ready(void);
   uint8_t dallas_temp_init(void);
   int16_t dallas_temp_print(void);
   int16_t dallas_temp10_get_last_known(void);
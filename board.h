@@ -52,6 +52,10 @@
 
 #define B0					B,0,1
 #define nTRX_IRQ			B,1,1 
+/* Pin change interrupt of the nTRX_IRQ pin (port B is PCINT0..7) */
+#define nTRX_IRQ_PCMSK		PCMSK0
+#define nTRX_IRQ_PCIE		PCIE0
+#define nTRX_IRQ_vect		PCINT0_vect
 #define nTRX_SEL			B,2,1
 #define TRX_MOSI			B,3,1
 #define TRX_MISO			B,4,1
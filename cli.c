@@ -28,7 +28,11 @@
 #include <errno.h>
 
 #include "cli.h"
+#ifdef __AVR__
 #include "common.h"
+#else
+#define PRINTF		printf
+#endif
 
 #define CR						'\n'
 #define LF						'\r'
@@ -38,6 +42,46 @@
 
 static cli_t g_ctx;
 
+#ifdef __AVR__
+/* Compare two command names, both in program memory */
+static int cli_cmdcmp(const char *a, const char *b)
+{
+	char ca, cb;
+
+	do {
+		ca = pgm_read_byte(a++);
+		cb = pgm_read_byte(b++);
+	} while (ca && ca == cb);
+	return (unsigned char)ca - (unsigned char)cb;
+}
+#else
+#define cli_cmdcmp		strcmp
+#endif
+
+/* Binary search of the command table, which is kept sorted by name */
+static cli_cmd_t *cli_find(cli_t *ctx, const char *cmd)
+{
+	int lo = 0, hi = ctx->ncmds, mid, r;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		r = CLI_STRCMP(cmd, ctx->cmds[mid].cmd);
+		if (r == 0)
+			return &ctx->cmds[mid];
+		if (r < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return NULL;
+}
+
+/* Registered command of the name, NULL if there is none */
+cli_cmd_t *cli_find_command(const char *cmd)
+{
+	return cli_find(&g_ctx, cmd);
+}
+
 static int cli_help(cli_t *ctx, void *arg, int argc, char **argv)
 {
 	int n;
@@ -61,156 +105,211 @@ static int cli_help(cli_t *ctx, void *arg, int argc, char **argv)
 int cli_register_command(const char *cmd, cli_handler_t handler, void *arg, const char *help)
 {
 	cli_t *ctx = &g_ctx;
+	int n;
 
 	if (ctx->ncmds == CLI_MAX_COMMANDS) {
 		PRINTF("Command registry full\n");
 		return -1;
 	}
 
-	ctx->cmds[ctx->ncmds].cmd = cmd;
-	ctx->cmds[ctx->ncmds].help = help;
-	ctx->cmds[ctx->ncmds].handler = handler;
-	ctx->cmds[ctx->ncmds].arg = arg;
+	/* Insert in order, cli_task() looks commands up by binary search */
+	for (n = ctx->ncmds; n > 0 && cli_cmdcmp(cmd, ctx->cmds[n - 1].cmd) < 0; n--)
+		ctx->cmds[n] = ctx->cmds[n - 1];
+
+	ctx->cmds[n].cmd = cmd;
+	ctx->cmds[n].help = help;
+	ctx->cmds[n].handler = handler;
+	ctx->cmds[n].arg = arg;
 	ctx->ncmds++;
 
 	return 0;
 }
 
-void cli_init(FILE *in, FILE *out, const char *name)
+void cli_init(FILE *in, FILE *out, int (*avail)(void), const char *name)
 {
 	cli_t *ctx = &g_ctx;
 
 	ctx->in = in;
 	ctx->out = out;
+	ctx->avail = avail;
 	ctx->name = name;
 
 	/* Register help command */
 	cli_register_command(STR("help"), cli_help, NULL, STR("List available commands"));
 }
 
-void cli_task(void)
+/* Display prompt and initialise the parser for a new line */
+static void cli_prompt(cli_t *ctx)
 {
-	cli_t *ctx = &g_ctx;
-	int rc;
-
-        PRINTF("CLI Ready\n\n");
-	while (1) {
-		char c;
-
-		/* Display prompt */
-		CLI_FPUTS(ctx->name, ctx->out);
-		CLI_FPUTS(STR("> "), ctx->out);
-
-		/* Initialise parser */
-		ctx->argv[0] = ctx->line;
-		ctx->argc = 1;
-		ctx->pos = 0;
-
-		/* Read line from input stream (with echo) */
-		for (;;) {
-			c = getc(ctx->in);
-			if (!ctx->is_quoted && (c == CR || c == LF)) {
-				/* End of line */
-				break;
-			}
+	CLI_FPUTS(ctx->name, ctx->out);
+	CLI_FPUTS(STR("> "), ctx->out);
+
+	ctx->argv[0] = ctx->line;
+	ctx->argc = 1;
+	ctx->pos = 0;
+}
+
+/* Take one input character (with echo), returns 1 when the line is complete */
+static int cli_input(cli_t *ctx, char c)
+{
+	if (!ctx->is_quoted && (c == CR || c == LF)) {
+		/* End of line */
+		return 1;
+	}
 
 #ifdef MAP_BS_TO_DEL
-			/* Convert backspace to delete */
-			if (c == BACKSPACE) {
-				c = DELETE;
-			}
+	/* Convert backspace to delete */
+	if (c == BACKSPACE) {
+		c = DELETE;
+	}
 #endif
 
-			/* Ignore non-printable characters */
-			if (c < 32 && c != CR) {
-				continue;
-			}
-
-			/* Handle line editing */
-			if (c == DELETE) {
-				if (ctx->pos) {
-					/* Back up the cursor */
-					putc(BACKSPACE, ctx->out);
-					putc(' ', ctx->out);
-					putc(BACKSPACE, ctx->out);
-					ctx->pos--;
-
-					/* Handle argument deletion */
-					if (ctx->pos && ctx->line[ctx->pos] != '\0' && ctx->line[ctx->pos - 1] == '\0') {
-						ctx->argc--;
-					}
-
-					/* Clear the deleted character from the buffer */
-					ctx->line[ctx->pos] = '\0';
-				}
-				continue;
-			}
+	/* Ignore non-printable characters */
+	if (c < 32 && c != CR) {
+		return 0;
+	}
 
-			/* Ignore input when buffer is full */
-			if (ctx->pos == CLI_MAX_LINE_LENGTH - 1 || ctx->argc == CLI_MAX_ARGS) {
-				continue;
+	/* Handle line editing */
+	if (c == DELETE) {
+		if (ctx->pos) {
+			/* Back up the cursor */
+			putc(BACKSPACE, ctx->out);
+			putc(' ', ctx->out);
+			putc(BACKSPACE, ctx->out);
+			ctx->pos--;
+
+			/* Handle argument deletion */
+			if (ctx->pos && ctx->line[ctx->pos] != '\0' && ctx->line[ctx->pos - 1] == '\0') {
+				ctx->argc--;
 			}
 
-			/* Echo character back to console */
-			putc(c, ctx->out);
-
-			/* Squash spaces to nulls unless quoted */
-			if (!ctx->is_quoted && c == ' ') {
-//				if (ctx->pos && ctx->line[ctx->pos - 1] != '\0') {
-//					/* Replace first space with a null - indicates new argument */
-//					c = '\0';
-//				} else {
-//					/* Subsequent spaces are ignored completely */
-//					continue;
-//				}
-				c = '\0';
-			}
+			/* Clear the deleted character from the buffer */
+			ctx->line[ctx->pos] = '\0';
+		}
+		return 0;
+	}
 
-			/* If this character is a quote then toggle quote state.  Trailing quotes
-			 * cause a null to be pushed to the buffer, indicating the start of a new
-			 * argument */
-			if (c == '"') {
-				ctx->is_quoted = !ctx->is_quoted;
-				if (ctx->is_quoted) {
-					/* Leading quote - no further action */
-					continue;
-				} else {
-					/* Convert trailing quote to null */
-					c = '\0';
-				}
-			}
+	/* Ignore input when buffer is full */
+	if (ctx->pos == CLI_MAX_LINE_LENGTH - 1 || ctx->argc == CLI_MAX_ARGS) {
+		return 0;
+	}
 
-			/* Add character to buffer */
-			ctx->line[ctx->pos] = c;
+	/* Echo character back to console */
+	putc(c, ctx->out);
+
+	/* Squash spaces to nulls unless quoted */
+	if (!ctx->is_quoted && c == ' ') {
+//		if (ctx->pos && ctx->line[ctx->pos - 1] != '\0') {
+//			/* Replace first space with a null - indicates new argument */
+//			c = '\0';
+//		} else {
+//			/* Subsequent spaces are ignored completely */
+//			return 0;
+//		}
+		c = '\0';
+	}
 
-			/* Check for start of new argument */
-			if (ctx->pos && c != '\0' && ctx->line[ctx->pos - 1] == '\0') {
-				ctx->argv[ctx->argc++] = &ctx->line[ctx->pos];
-			}
-			ctx->pos++;
+	/* If this character is a quote then toggle quote state.  Trailing quotes
+	 * cause a null to be pushed to the buffer, indicating the start of a new
+	 * argument */
+	if (c == '"') {
+		ctx->is_quoted = !ctx->is_quoted;
+		if (ctx->is_quoted) {
+			/* Leading quote - no further action */
+			return 0;
+		} else {
+			/* Convert trailing quote to null */
+			c = '\0';
 		}
+	}
 
-		/* Terminate final argument */
-		ctx->line[ctx->pos] = '\0';
-		putc(CR, ctx->out);
+	/* Add character to buffer */
+	ctx->line[ctx->pos] = c;
 
-		if (ctx->pos) {
-			int i;
-
-			/* Pass command to handler, if available */
-			for (i = 0; i < ctx->ncmds; i++) {
-				if (CLI_STRCMP(ctx->argv[0], ctx->cmds[i].cmd) == 0) {
-					rc = (ctx->cmds[i].handler)(ctx, ctx->cmds[i].arg, ctx->argc, ctx->argv);
-					if (rc != 0) {
-						CLI_FPRINTF(ctx->out, STR("Error %d\n"), rc);
-					}
-					break;
-				}
-			}
-			if (i == ctx->ncmds) {
-				CLI_FPUTS(STR("Unknown command\n"), ctx->out);
-			}
+	/* Check for start of new argument */
+	if (ctx->pos && c != '\0' && ctx->line[ctx->pos - 1] == '\0') {
+		ctx->argv[ctx->argc++] = &ctx->line[ctx->pos];
+	}
+	ctx->pos++;
+	return 0;
+}
+
+/* Report the tick at which the command takes effect on the ACK line:
+ * the handler passes the tick it read before queueing the command and
+ * the ETA the queueing returned */
+void cli_ack_tick(cli_t *ctx, unsigned int now, unsigned int tick)
+{
+	ctx->ack_now = now;
+	ctx->ack_tick = tick;
+	ctx->ack_tick_set = 1;
+}
+
+/* Execute the line.  A line starting with a request ID, e.g.
+ * "#42 fht set 3 120", is answered with a single line
+ * "ACK #42 rc='0' [now='<tick>' tick='<tick>']" or "NAK #42 rc='<rc>'"
+ * (rc -1 for an unknown command) so that the host can match the replies
+ * of several commands in flight. */
+static void cli_execute(cli_t *ctx)
+{
+	cli_cmd_t *cmd = NULL;
+	char **argv = ctx->argv;
+	int argc = ctx->argc;
+	int rc = -1;
+
+	/* Terminate final argument */
+	ctx->line[ctx->pos] = '\0';
+	putc(CR, ctx->out);
+
+	if (!ctx->pos)
+		return;
+
+	ctx->req_id = NULL;
+	ctx->ack_tick_set = 0;
+	if (argv[0][0] == '#') {
+		ctx->req_id = argv[0];
+		argv++;
+		argc--;
+	}
+
+	/* Pass command to handler, if available */
+	if (argc)
+		cmd = cli_find(ctx, argv[0]);
+	if (cmd) {
+		rc = (cmd->handler)(ctx, cmd->arg, argc, argv);
+	}
+
+	if (ctx->req_id) {
+		if (rc != 0) {
+			CLI_FPRINTF(ctx->out, STR("NAK %s rc='%d'\n"), ctx->req_id, rc);
+		} else if (ctx->ack_tick_set) {
+			CLI_FPRINTF(ctx->out, STR("ACK %s rc='0' now='%u' tick='%u'\n"),
+					ctx->req_id, ctx->ack_now, ctx->ack_tick);
+		} else {
+			CLI_FPRINTF(ctx->out, STR("ACK %s rc='0'\n"), ctx->req_id);
 		}
+		ctx->req_id = NULL;
+	} else if (!cmd) {
+		CLI_FPUTS(STR("Unknown command\n"), ctx->out);
+	} else if (rc != 0) {
+		CLI_FPRINTF(ctx->out, STR("Error %d\n"), rc);
 	}
 }
 
+void cli_task(void)
+{
+	cli_t *ctx = &g_ctx;
+
+	if (!ctx->ready) {
+		ctx->ready = 1;
+		PRINTF("CLI Ready\n\n");
+		cli_prompt(ctx);
+	}
+
+	/* Consume the input available, a complete line is executed */
+	while (ctx->avail()) {
+		if (cli_input(ctx, getc(ctx->in))) {
+			cli_execute(ctx);
+			cli_prompt(ctx);
+		}
+	}
+}
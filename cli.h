@@ -28,6 +28,11 @@
 #include <stdio.h>
 #include "defs.h"
 
+/* If this is a C++ compiler, use C linkage */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #ifdef __ARDUINO__
 #define CLI_FPUTS	fputs_P
 #define CLI_FPRINTF	fprintf_P
@@ -49,8 +54,11 @@
 #define CLI_MAX_LINE_LENGTH		128
 /*! Maximum number of arguments to accept (including command itself) */
 #define CLI_MAX_ARGS			16
-/*! Maximum number of commands to support */
-#define CLI_MAX_COMMANDS		20
+/*! Maximum number of commands to support (8 B RAM each, "help" and the
+    6 commands of main.c are registered) */
+#ifndef CLI_MAX_COMMANDS
+#define CLI_MAX_COMMANDS		8
+#endif
 
 struct cli;
 typedef int (*cli_handler_t)(struct cli*, void*, int, char**);
@@ -66,6 +74,8 @@ typedef struct cli {
 	const char *name;				/*< CLI name */
 	FILE *in;						/*< Input stream */
 	FILE *out;						/*< Output stream */
+	int (*avail)(void);				/*< Returns non-zero if input is available */
+	int ready;						/*< Set once the first prompt is shown */
 	cli_cmd_t cmds[CLI_MAX_COMMANDS]; /*< Command table */
 	int ncmds;						/*< Number of registered commands */
 
@@ -75,10 +85,27 @@ typedef struct cli {
 
 	int argc;						/*< Number of arguments + command */
 	char *argv[CLI_MAX_ARGS];		/*< Array of pointers to arguments */
+
+	const char *req_id;				/*< Request ID ("#<id>" prefix) of the command, NULL if none */
+	int ack_tick_set;				/*< Set if the handler reported the ticks below */
+	unsigned int ack_now;			/*< Tick at which the command was taken */
+	unsigned int ack_tick;			/*< Tick at which the command takes effect */
 } cli_t;
 
-void cli_init(FILE *in, FILE *out, const char *name);
+void cli_init(FILE *in, FILE *out, int (*avail)(void), const char *name);
 int cli_register_command(const char *cmd, cli_handler_t handler, void *arg, const char *help);
+cli_cmd_t *cli_find_command(const char *cmd);
+
+/*! Reports the tick at which the command takes effect, for the ACK line of
+    a request with an ID.  Called by the command handlers. */
+void cli_ack_tick(cli_t *ctx, unsigned int now, unsigned int tick);
+
+/*! Processes the input available and returns, a complete line is executed.
+    Called repeatedly from the main loop. */
 void cli_task(void);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* CLI_H_ */
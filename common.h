@@ -51,6 +51,7 @@ typedef enum {
 
 // Define debugging macros.  These require extra include files
 // which the following will pull in.
+#include <stdint.h>
 #include "defs.h"
 #include <avr/pgmspace.h>
 #ifdef DEBUG
@@ -75,12 +76,33 @@ typedef enum {
 #define PRINTF(a,...)                   { printf_P(PSTR(a), ##__VA_ARGS__); }
 
 
+/*
+ * Log levels: 0 - events, 1 - information, 2 - verbose.
+ * The level is printed after the source ("LOG FHT 0 RFM_TX ...").
+ * Call sites above LOG_LEVEL_MAX are compiled out, the rest is checked
+ * against the runtime threshold (CLI "log <level>") before formatting.
+ * Level 0 is always printed.
+ */
+#ifndef LOG_LEVEL_MAX
+#define LOG_LEVEL_MAX		2
+#endif
+
+#ifdef __cplusplus /* If this is a C++ compiler, use C linkage */
+extern "C" {
+#endif
+extern uint8_t g_log_level;
+#ifdef __cplusplus
+}
+#endif
+
+#define LOG_ENABLED(lvl)	((lvl) == 0 || ((lvl) <= LOG_LEVEL_MAX && (lvl) <= g_log_level))
+
 // classic old-style messages
 #define MSG_TMP(a,...)                   { printf_P(PSTR("MSG TMP " a), ##__VA_ARGS__); }
-#define LOG_TMP(a,...)                   { printf_P(PSTR("LOG TMP " a), ##__VA_ARGS__); }
+#define LOG_TMP(lvl,a,...)               { if (LOG_ENABLED(lvl)) printf_P(PSTR("LOG TMP " #lvl " " a), ##__VA_ARGS__); }
 
 //#define MSG_FHT(a,...)                   { printf_P(PSTR("MSG FHT " a), ##__VA_ARGS__); }
-#define LOG_FHT(a,...)                   { printf_P(PSTR("LOG FHT " a), ##__VA_ARGS__); }
+#define LOG_FHT(lvl,a,...)               { if (LOG_ENABLED(lvl)) printf_P(PSTR("LOG FHT " #lvl " " a), ##__VA_ARGS__); }
 
 #define LOG_CLI(a,...)                   { printf_P(PSTR("CLI " a), ##__VA_ARGS__); }
 
@@ -18,14 +18,15 @@
  * under the Licence.
  *
  * \file debug.c
- * \brief Un-buffered UART driver for debug IO
+ * \brief UART driver for debug IO
  *
  * Debug UART driver for ATMEL AVR ATMEGA.  Provides
- * integration with stdio and un-buffered input/output.
+ * integration with stdio and interrupt-driven buffered input/output.
  *
  */
 
 #include <avr/io.h>
+#include <avr/interrupt.h>
 #include <stdio.h>
 
 #include "board.h"
@@ -45,6 +46,8 @@
 #define _UCSRA				UCSRA
 #define _UCSRB				UCSRB
 #define _UCSRC				UCSRC
+#define _UDRE_vect			USART_UDRE_vect
+#define _RXC_vect			USART_RXC_vect
 
 #elif (defined(__AVR_ATmega128__) \
  || defined (__AVR_ATmega1280__) || defined (_AVR_ATmega1281__) \
@@ -64,6 +67,13 @@
 #define _UCSRA				UCSR0A
 #define _UCSRB				UCSR0B
 #define _UCSRC				UCSR0C
+#ifdef USART0_UDRE_vect
+#define _UDRE_vect			USART0_UDRE_vect
+#define _RXC_vect			USART0_RX_vect
+#else
+#define _UDRE_vect			USART_UDRE_vect
+#define _RXC_vect			USART_RX_vect
+#endif
 #elif DEBUG_PORT == 1
 #define _UDR				UDR1
 #define _UBRRL				UBRR1L
@@ -71,6 +81,8 @@
 #define _UCSRA				UCSR1A
 #define _UCSRB				UCSR1B
 #define _UCSRC				UCSR1C
+#define _UDRE_vect			USART1_UDRE_vect
+#define _RXC_vect			USART1_RX_vect
 #else
 # warning "Selected port number not supported by <debug.c>"
 #endif
@@ -79,6 +91,31 @@
 # warning "CPU type not supported by <debug.c>"
 #endif
 
+#if DEBUG_IS_UART
+#define _UDRE				UDRE
+#define _UDRIE				UDRIE
+#define _RXCIE				RXCIE
+#define _FE					FE
+#define _DOR				DOR
+#else
+#define _UDRE				UDRE0
+#define _UDRIE				UDRIE0
+#define _RXCIE				RXCIE0
+#define _FE					FE0
+#define _DOR				DOR0
+#endif
+
+#define TX_MASK				(DEBUG_TX_BUF_SIZE - 1)
+#define RX_MASK				(DEBUG_RX_BUF_SIZE - 1)
+
+static char tx_buf[DEBUG_TX_BUF_SIZE];
+static volatile uint8_t tx_head;	// written by debug_putc()
+static volatile uint8_t tx_tail;	// written by the UDRE interrupt
+static char rx_buf[DEBUG_RX_BUF_SIZE];
+static volatile uint8_t rx_head;	// written by the RXC interrupt
+static volatile uint8_t rx_tail;	// written by debug_getc()
+static debug_stats_t debug_stats;
+
 #if DEBUG_IS_STDIO
 /// Wrapper function for interfacing with stdio fdevopen.
 /// Replaces line-feed characters with a
@@ -205,42 +242,112 @@ void debug_init(void)
 	stdin = &debug_stdin;
 #endif
 
-	// Enable transceiver
+	// Enable transceiver and the receive interrupt
 #if DEBUG_IS_UART
-	_UCSRB = _BV(TXEN) | _BV(RXEN);
+	_UCSRB = _BV(TXEN) | _BV(RXEN) | _BV(_RXCIE);
 #else
-	_UCSRB = _BV(TXEN0) | _BV(RXEN0);
+	_UCSRB = _BV(TXEN0) | _BV(RXEN0) | _BV(_RXCIE);
 #endif
 }
 
+/// UART receive complete - buffer the character
+ISR(_RXC_vect)
+{
+	uint8_t status = _UCSRA;
+	uint8_t next = (rx_head + 1) & RX_MASK;
+	char c = _UDR;
+
+	if (status & _BV(_DOR))
+		debug_stats.rx_overrun++;
+	if (status & _BV(_FE)) {
+		debug_stats.rx_frame++;
+		return;
+	}
+	if (next == rx_tail) {
+		debug_stats.rx_dropped++;
+		return;
+	}
+	rx_buf[rx_head] = c;
+	rx_head = next;
+}
+
 int debug_poll(void)
 {
-#if DEBUG_IS_UART
-	return !!(_UCSRA & _BV(RXC));
-#else
-	return !!(_UCSRA & _BV(RXC0));
-#endif
+	return rx_head != rx_tail;
 }
 
 char debug_getc(void)
 {
+	char c;
+
 	// Wait for data to be available
-#if DEBUG_IS_UART
-	while (! (_UCSRA & _BV(RXC)));
-#else
-	while (! (_UCSRA & _BV(RXC0)));
-#endif
-	return _UDR;
-	
+	while (!debug_poll());
+	c = rx_buf[rx_tail];
+	rx_tail = (rx_tail + 1) & RX_MASK;
+	return c;
+}
+
+/// Transmit the oldest buffered character, waiting for the UART to
+/// become ready (used when the interrupt cannot run)
+static void debug_tx_poll(void)
+{
+	while (! (_UCSRA & _BV(_UDRE)));
+	_UDR = tx_buf[tx_tail];
+	tx_tail = (tx_tail + 1) & TX_MASK;
 }
 
 void debug_putc(char c)
 {
-	// Wait for transmitter to become ready
-#if DEBUG_IS_UART
-	while (! (_UCSRA & _BV(UDRE)));
+	uint8_t sreg = SREG;
+	uint8_t next, full = 0;
+
+	// The buffer is shared with interrupt handlers that print, too
+	cli();
+	while ((next = (tx_head + 1) & TX_MASK) == tx_tail) {
+		if (!full) {
+			full = 1;
+			debug_stats.tx_full++;
+		}
+#if DEBUG_TX_POLICY == DEBUG_TX_DROP_NEWEST
+		debug_stats.tx_dropped++;
+		SREG = sreg;
+		return;
+#elif DEBUG_TX_POLICY == DEBUG_TX_DROP_OLDEST
+		debug_stats.tx_dropped++;
+		tx_tail = (tx_tail + 1) & TX_MASK;
 #else
-	while (! (_UCSRA & _BV(UDRE0)));
+		if (sreg & _BV(SREG_I)) {
+			// Let the interrupt make room
+			SREG = sreg;
+			while (((tx_head + 1) & TX_MASK) == tx_tail);
+			cli();
+		} else {
+			debug_tx_poll();
+		}
 #endif
-	_UDR = c;
+	}
+	tx_buf[tx_head] = c;
+	tx_head = next;
+	_UCSRB |= _BV(_UDRIE);
+	SREG = sreg;
+}
+
+/// UART data register empty - send the next buffered character
+ISR(_UDRE_vect)
+{
+	if (tx_tail == tx_head) {
+		_UCSRB &= ~_BV(_UDRIE);
+		return;
+	}
+	_UDR = tx_buf[tx_tail];
+	tx_tail = (tx_tail + 1) & TX_MASK;
+}
+
+void debug_get_stats(debug_stats_t *stats)
+{
+	uint8_t sreg = SREG;
+
+	cli();
+	*stats = debug_stats;
+	SREG = sreg;
 }
@@ -18,10 +18,10 @@
  * under the Licence.
  *
  * \file debug.h
- * \brief Un-buffered UART driver for debug IO
+ * \brief UART driver for debug IO
  *
  * Debug UART driver for ATMEL AVR ATMEGA.  Provides
- * integration with stdio and un-buffered input/output.
+ * integration with stdio and interrupt-driven buffered input/output.
  *
  */
 
@@ -58,6 +58,24 @@
 /// If the UART is to operate in synchronous mode
 #define DEBUG_SYNC			0
 
+/// Transmit ring buffer size (must be a power of 2)
+#ifndef DEBUG_TX_BUF_SIZE
+#define DEBUG_TX_BUF_SIZE	128
+#endif
+
+/// Receive ring buffer size (must be a power of 2)
+#ifndef DEBUG_RX_BUF_SIZE
+#define DEBUG_RX_BUF_SIZE	64
+#endif
+
+/// What debug_putc() does when the transmit buffer is full
+#define DEBUG_TX_BLOCK			0	///< wait for room (polls the UART when interrupts are disabled)
+#define DEBUG_TX_DROP_OLDEST	1	///< discard the oldest buffered character
+#define DEBUG_TX_DROP_NEWEST	2	///< discard the new character
+#ifndef DEBUG_TX_POLICY
+#define DEBUG_TX_POLICY		DEBUG_TX_BLOCK
+#endif
+
 /// If the UART is to bind to stdio
 #ifdef DEBUG
 #define DEBUG_IS_STDIO		1
@@ -93,13 +111,28 @@ void debug_init(void);
 int debug_poll(void);
 
 /// Returns a single character from the debug serial port, blocking until
-/// one is available.
+/// one is available.  Characters are received by the RXC interrupt into
+/// a ring buffer, so input is not lost while the main loop is busy.
 /// \return Received character
 char debug_getc(void);
 
-/// Sends a single character out of the debug serial port, blocking until
-/// the transmission can commence.
+/// Queues a single character for transmission on the debug serial port.
+/// The transmit buffer is drained by the UDRE interrupt, see DEBUG_TX_POLICY
+/// for what happens when it is full.
 /// \param c Character to send
 void debug_putc(char c);
 
+/// Driver statistics
+typedef struct {
+	uint16_t tx_full;		///< debug_putc() found the transmit buffer full
+	uint16_t tx_dropped;	///< characters discarded by the overflow policy
+	uint16_t rx_dropped;	///< characters lost to a full receive buffer
+	uint16_t rx_overrun;	///< data overruns reported by the UART (DOR)
+	uint16_t rx_frame;		///< characters discarded with a framing error (FE)
+} debug_stats_t;
+
+/// Copies the driver statistics
+/// \param stats Destination
+void debug_get_stats(debug_stats_t *stats);
+
 #endif /*DEBUG_H_*/
@@ -0,0 +1,76 @@
+/*
+* Copyright 2013 Hynek Baran
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/*
+* Event log ring, see evlog.h
+*/
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stdint.h>
+
+#include "evlog.h"
+
+static evlog_rec_t g_evlog[EVLOG_DIM];
+static volatile uint8_t g_evlog_head;     // written by evlog_put()
+static volatile uint8_t g_evlog_tail;     // written by evlog_get()
+static volatile uint16_t g_evlog_dropped;
+
+void evlog_put(uint8_t id, uint8_t group, uint16_t tick, uint16_t arg0, uint16_t arg1)
+{
+  uint8_t sreg = SREG, head;
+  evlog_rec_t *rec;
+
+  /* Both the main loop and interrupts record, claim the slot atomically */
+  cli();
+  head = g_evlog_head;
+  if (((head + 1) & (EVLOG_DIM - 1)) == g_evlog_tail) {
+    g_evlog_dropped++;
+    SREG = sreg;
+    return;
+  }
+  rec = &g_evlog[head];
+  rec->id = id;
+  rec->group = group;
+  rec->tick = tick;
+  rec->arg[0] = arg0;
+  rec->arg[1] = arg1;
+  g_evlog_head = (head + 1) & (EVLOG_DIM - 1);
+  SREG = sreg;
+}
+
+uint8_t evlog_get(evlog_rec_t *rec)
+{
+  uint8_t tail = g_evlog_tail;
+
+  /* Single consumer, the record is published before the head moves */
+  if (tail == g_evlog_head)
+    return 0;
+  *rec = g_evlog[tail];
+  g_evlog_tail = (tail + 1) & (EVLOG_DIM - 1);
+  return 1;
+}
+
+uint16_t evlog_dropped(void)
+{
+  uint8_t sreg = SREG;
+  uint16_t n;
+
+  cli();
+  n = g_evlog_dropped;
+  SREG = sreg;
+  return n;
+}
@@ -0,0 +1,53 @@
+/*
+* Copyright 2013 Hynek Baran
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/*
+* Event log recorder.
+*
+* Code running in interrupt context records compact events (an ID, the tick
+* and a few integer arguments) instead of printing them.  The main loop
+* takes the records in order and formats them, so no printf runs in the ISR
+* and the timeline keeps the tick of every event.
+*/
+
+#ifndef EVLOG_H_
+#define EVLOG_H_
+
+#include <stdint.h>
+
+/*! Number of records buffered (must be a power of 2), 8 bytes each */
+#ifndef EVLOG_DIM
+#define EVLOG_DIM		16
+#endif
+
+typedef struct {
+  uint8_t id;                   /* event ID, defined by the user of the log */
+  uint8_t group;
+  uint16_t tick;
+  uint16_t arg[2];
+} evlog_rec_t;
+
+/*! Record an event, may be called from any context.  The event is counted
+    as dropped if the log is full. */
+void evlog_put(uint8_t id, uint8_t group, uint16_t tick, uint16_t arg0, uint16_t arg1);
+
+/*! Take the oldest record, returns 0 if the log is empty (main loop only) */
+uint8_t evlog_get(evlog_rec_t *rec);
+
+/*! Number of events dropped so far */
+uint16_t evlog_dropped(void);
+
+#endif /* EVLOG_H_ */
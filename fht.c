@@ -37,9 +37,12 @@
 #include "common.h"
 #include "si443x_min.h"
 #include "fht.h"
+#include "fht_codec.h"
 #include "fht_eeprom.h"
 #include "DS18x20.h"
 #include "temp.h"
+#include "tlm.h"
+#include "evlog.h"
 
 /*! Number of ticks to remain in sync mode (must be even) */
 #define SYNC_TICKS		240
@@ -47,14 +50,56 @@
    one tick for each higher slot */
 #define PERIOD_BASE		230
 
-static volatile fht_msg_t g_message  [FHT_GROUPS_DIM];
-static volatile uint8_t g_slot_count [FHT_GROUPS_DIM];
+/*
+   Group table, one array per message field (structure of arrays): 5 bytes
+   per group without padding.  The command byte holds the command in the low
+   nibble and the flags in the high nibble, as sent on air.  The checksum is
+   not stored, fht_grp_msg() computes it when it assembles a message.
+*/
+static volatile uint8_t g_grp_hc1  [FHT_GROUPS_DIM];
+static volatile uint8_t g_grp_hc2  [FHT_GROUPS_DIM];
+static volatile uint8_t g_grp_addr [FHT_GROUPS_DIM];
+static volatile uint8_t g_grp_cmd  [FHT_GROUPS_DIM];
+static volatile uint8_t g_grp_ext  [FHT_GROUPS_DIM];
+static volatile uint8_t g_slot_count [FHT_GROUPS_DIM];  // sync countdown
+static volatile uint8_t g_grp_syncing [FHT_GROUPS_DIM]; // sync started, SYNC DONE not logged yet
 static volatile uint16_t g_ticks = 0;
 static volatile uint32_t g_last_command_enqueued_time = 0;
-static volatile uint8_t g_nbits;
 
 static volatile uint8_t g_freezingMode = 0;
 
+/* Event log IDs, see fht_log_task().  A command or sync of all the groups
+   is one RFM_TQ or SYNC_START record of group FHT_LOG_ALL, it is printed
+   as the records of each group would be (see fht_log_all()). */
+#define FHT_LOG_ALL             ((uint8_t)grp_indx_all)
+#define FHT_LOG_RFM_TQ          1     // arg0: command << 8 | extension, arg1: address << 8 | pending
+#define FHT_LOG_RFM_TQ_DROP     2     // as FHT_LOG_RFM_TQ
+#define FHT_LOG_PANIC_ON        3     // arg0: tick of the last enqueued command
+#define FHT_LOG_FREEZING_ENTER  4     // arg0: temperature * 10
+#define FHT_LOG_FREEZING_LEAVE  5     // arg0: temperature * 10
+#define FHT_LOG_FREEZING_TX     6     // arg0: temperature * 10
+#define FHT_LOG_TICK_IGNORED    7
+#define FHT_LOG_SYNC_START      8
+#define FHT_LOG_SYNC_PROGRESS   9     // arg0: sync countdown
+#define FHT_LOG_SYNC_DONE       10
+
+/* Groups whose command for all the groups was dropped, not logged yet */
+static volatile uint8_t g_log_all_dropped [(FHT_GROUPS_DIM + 7) / 8];
+
+static void fht_rx_resume(void);
+static void msg_print(fht_msg_t *msg, grp_indx_t group, int8_t verb);
+
+/* Assemble the current message of the group, checksum included */
+static void fht_grp_msg(grp_indx_t group, fht_msg_t *msg)
+{
+  msg->hc1 = g_grp_hc1[group];
+  msg->hc2 = g_grp_hc2[group];
+  msg->address = g_grp_addr[group];
+  msg->command = g_grp_cmd[group];
+  msg->extension = g_grp_ext[group];
+  msg->checksum = 0x0c + msg->hc1 + msg->hc2 + msg->address + msg->command + msg->extension;
+}
+
 static void print_uptime(unsigned long seconds)
 {
   unsigned long secs = seconds;
@@ -68,7 +113,7 @@ static void print_uptime(unsigned long seconds)
   mins = mins - (hours * 60); //subtract the coverted minutes to hours in order to display 59 minutes max
   hours = hours - (days * 24); //subtract the coverted hours to days in order to display 23 hours max
   //Display results
-  LOG_FHT("1 Uptime  %lu days %lu:%lu:%lu\n", days, hours, mins, secs);
+  LOG_FHT(1, "Uptime  %lu days %lu:%lu:%lu\n", days, hours, mins, secs);
 }
 
 static void cmddump(fht_msg_t *msg)
@@ -162,183 +207,538 @@ static void hexdump(uint8_t *buf, int size)
   printf_P(PSTR("\n"));
 }
 
+#define FHT_BUFFER_SIZE	64
+
+/* Encoded frame size for variable length bitstream
+   The preamble is always 54 actual bits long (12 0's and a 1)
+   The payload is 54 bits - maximum actual length = 54x6 = 324 bits
+   Terminates with two 0's = 8 bits
+   Maximum frame size therefore = 49 bytes + 4 for extra preamble
+*/
+#define FHT_FRAME_SIZE	53
+
+/* Number of leading message bytes (hc1, hc2, address, command) the encoder
+   state is saved after - the frame may be resumed from there when only
+   the extension and checksum change (e.g. SYNC countdown) */
+#define FHT_FRAME_HEAD	4
+
+/* Encoded frame cache, the entries are tagged by group and the least
+   recently used one is replaced.
+   The frame is re-encoded only when the message it was encoded from
+   (hc1, hc2, address, command or extension) has changed.
+   The cache is not sized by the groups (an entry is 66 B): with more
+   groups transmitting in turn than entries, e.g. all of them syncing,
+   every frame misses and costs one full table-driven encode.  The groups
+   take their timeslots in turn, so more entries would only help several
+   groups syncing at once; two keep a syncing group besides the others. */
+typedef struct {
+  fht_msg_t msg;                  /* message the frame was encoded from */
+  uint8_t group;                  /* owner of the entry */
+  uint16_t used;                  /* g_frame_clock of the last use */
+  uint8_t len;                    /* frame length, 0 if empty */
+  uint8_t head_len;               /* encoder state after FHT_FRAME_HEAD bytes: */
+  uint8_t head_acc;               /*   whole bytes written, pending bits */
+  uint8_t head_nbits;             /*   and their count */
+  uint8_t frame[FHT_FRAME_SIZE];  /* encoded frame */
+} fht_frame_t;
+
+#ifndef FHT_FRAME_CACHE_DIM
+#define FHT_FRAME_CACHE_DIM	2
+#endif
+
+static fht_frame_t g_frame [FHT_FRAME_CACHE_DIM];
+static uint16_t g_frame_clock;
+
+/* Find the cache entry of the group, or take over the empty or least
+   recently used one */
+static fht_frame_t *fht_frame_entry(uint8_t group)
+{
+  fht_frame_t *f, *victim = g_frame;
+  uint8_t n;
+
+  g_frame_clock++;
+  for (n = 0, f = g_frame; n < FHT_FRAME_CACHE_DIM; n++, f++) {
+    if (f->len && f->group == group)
+      goto found;
+    if (victim->len && (!f->len || (uint16_t)(g_frame_clock - f->used) > (uint16_t)(g_frame_clock - victim->used)))
+      victim = f;
+  }
+  f = victim;
+  f->len = 0;
+  f->group = group;
+found:
+  f->used = g_frame_clock;
+  return f;
+}
+
+/* Return the encoded frame of the group message (as assembled by fht_grp_msg(),
+   with checksum), encode it if the cache is stale.
+   Every frame byte is also passed to sink (if not NULL), a stale frame is
+   encoded straight into the sink in the same pass. */
+static fht_frame_t *fht_frame_get(uint8_t group, const fht_msg_t *message, fht_sink_t sink)
+{
+  fht_frame_t *f = fht_frame_entry(group);
+  fht_msg_t msg = *message;
+  uint8_t *_msg = (uint8_t*) &msg;
+  fht_enc_t enc;
+  int n;
+
+  if (f->len && memcmp(&f->msg, &msg, sizeof(fht_msg_t)) == 0) {
+    if (sink)
+      for (n = 0; n < f->len; n++)
+        sink(f->frame[n]);
+    return f;
+  }
+
+  if (f->len && memcmp(&f->msg, &msg, FHT_FRAME_HEAD) == 0) {
+    /* Same head - patch the tail only */
+    if (sink)
+      for (n = 0; n < f->head_len; n++)
+        sink(f->frame[n]);
+    enc.out = f->frame + f->head_len;
+    enc.sink = sink;
+    enc.acc = f->head_acc;
+    enc.nbits = f->head_nbits;
+  } else {
+    fht_rfm_encode_start(&enc, f->frame, sink);
+    for (n = 0; n < FHT_FRAME_HEAD; n++)
+      fht_enc_byte(&enc, _msg[n]);
+    f->head_len = enc.out - f->frame;
+    f->head_acc = enc.acc;
+    f->head_nbits = enc.nbits;
+  }
+  for (n = FHT_FRAME_HEAD; n < sizeof(fht_msg_t); n++)
+    fht_enc_byte(&enc, _msg[n]);
+  f->len = fht_rfm_encode_finish(&enc, f->frame);
+  f->msg = msg;
+  //if (DEBUG > 1) hexdump(f->frame, f->len);
+
+  return f;
+}
+
 /*
-   Takes another FHT protocol bit and encodes it into either
-   1100 (for a 0) or 111000 (for a 1) and pushes it to the
-   transmitter output buffer.
+   Deferred transmission: the tick interrupt only posts a snapshot of the
+   message to be sent, fht_tx_task() transmits it from the main loop.
 */
-static void pushbit(int bit, uint8_t **outptr)
+
+#define FHT_TXQ_DIM	8  // must be a power of 2
+
+/*! Gap between the two copies of a frame (in bytes of zero bits) */
+#define FHT_TX_GAP_BYTES  5  // 8 ms gap between the copies (1.6 ms per byte)
+/*! Airtime of a job sending a frame of len bytes twice, 1.6 ms per byte */
+#define FHT_TX_AIRTIME_MS(len)  (((2 * (uint16_t)(len) + FHT_TX_GAP_BYTES) * 8) / 5)
+/*! Tick period [ms] */
+#define FHT_TICK_MS       500
+
+typedef struct {
+  fht_msg_t msg;
+  uint8_t group;
+  uint8_t len;     // encoded frame length
+  uint16_t tick;   // tick of the timeslot
+} fht_tx_job_t;
+
+static fht_tx_job_t g_txq [FHT_TXQ_DIM];
+static volatile uint8_t g_txq_head = 0;      // written by fht_tick()
+static volatile uint8_t g_txq_tail = 0;      // written by fht_tx_task()
+static volatile uint16_t g_txq_dropped = 0;  // jobs lost to a full queue
+
+/* Arbiter statistics (fht stats) */
+static uint16_t g_txs_sent = 0;              // jobs transmitted
+static uint16_t g_txs_late = 0;              // jobs started after the tick following their timeslot (sync: a tick later)
+static uint16_t g_txs_reordered = 0;         // jobs sent ahead of older ones
+static uint16_t g_txs_deferred = 0;          // sync frames held for the next tick
+static uint8_t g_txs_max_queued = 0;         // queue high-water mark
+static volatile uint16_t g_tick_airtime = 0;       // airtime posted in the current tick [ms]
+static volatile uint16_t g_tick_airtime_max = 0;   // most airtime posted in one tick [ms]
+static volatile uint16_t g_ticks_overbooked = 0;   // ticks with more airtime than the tick period
+static volatile uint16_t g_tick_overruns = 0;      // tick handler still running at the next tick
+static volatile uint16_t g_ticks_lost = 0;         // ticks missed by the timer interrupt
+static volatile uint8_t g_ticks_missed = 0;        // lost ticks not yet caught up
+
+/* Queue the current group message for transmission (called from ISR) */
+static void fht_post_tx(uint8_t group)
 {
-  static uint8_t byteval = 0;
-  int size, shift;
-  uint8_t mask;
+  uint8_t next = (g_txq_head + 1) & (FHT_TXQ_DIM - 1);
+  fht_tx_job_t *job = &g_txq[g_txq_head];
 
-  if (bit) {
-    // 1 is 600us on/off - load 111000 to output
-    size = 6;
-    mask = 0x38;
+  if (next == g_txq_tail) {
+    g_txq_dropped++;
+    return;
   }
-  else {
-    // 0 is 400us on/off - load 1100 to output
-    size = 4;
-    mask = 0x0c;
-  }
-
-  while (size) {
-    // shift to fit
-    shift = (size > (8 - g_nbits)) ? (8 - g_nbits) : size;
-    byteval = (byteval << shift) | (mask >> (size - shift));
-    size -= shift;
-    g_nbits += shift;
-    if (g_nbits == 8) {
-      *(*outptr) = byteval;
-      (*outptr)++;
-      g_nbits = 0;
-    }
+  fht_grp_msg(group, &job->msg);
+  job->group = group;
+  job->tick = g_ticks;
+
+  /* The airtime is known before encoding */
+  job->len = fht_rfm_encoded_len((uint8_t*) &job->msg, FHT_MSG_SIZE);
+  g_tick_airtime += FHT_TX_AIRTIME_MS(job->len);
+
+  g_txq_head = next;
+}
+
+/*
+   Queued jobs are sent in the order of their cost of being late: timeslot
+   messages, which the valve only listens for in a short window, go before
+   the sync countdown (sent every second, a late one is just less precise).
+   Among those a job posted in an earlier tick goes first, then the
+   shortest airtime, so a burst of same-tick jobs ends as early as possible
+   for most of them.
+*/
+static uint8_t fht_tx_is_sync(fht_tx_job_t *job)
+{
+  return (job->msg.command & 0xf) == FHT_SYNC;
+}
+
+static uint16_t fht_tx_rank(fht_tx_job_t *job, uint16_t now)
+{
+  return (fht_tx_is_sync(job) << 9) | (((uint16_t)(now - job->tick) <= 1) << 8) | job->len;
+}
+
+/* Move the job to be sent next to the queue tail */
+static void fht_tx_pick(uint16_t now)
+{
+  uint8_t head = g_txq_head, tail = g_txq_tail;
+  uint8_t n, prev, best = tail, queued = (head - tail) & (FHT_TXQ_DIM - 1);
+  fht_tx_job_t job;
+
+  if (queued > g_txs_max_queued)
+    g_txs_max_queued = queued;
+
+  for (n = (tail + 1) & (FHT_TXQ_DIM - 1); n != head; n = (n + 1) & (FHT_TXQ_DIM - 1))
+    if (fht_tx_rank(&g_txq[n], now) < fht_tx_rank(&g_txq[best], now))
+      best = n;
+  if (best == tail)
+    return;
+
+  /* Jobs in between keep their order, only the fht_tick() end of the
+     queue is touched from the interrupt */
+  job = g_txq[best];
+  for (n = best; n != tail; n = prev) {
+    prev = (n - 1) & (FHT_TXQ_DIM - 1);
+    g_txq[n] = g_txq[prev];
   }
+  g_txq[tail] = job;
+  g_txs_reordered++;
 }
 
-/*!
-   Encode a buffer into a format that will generate
-   the FHT pulse-width encoding when transmitted.
-   Parity bit is added for each byte.
+/*
+   Each job is sent twice in one transmission: the frame, a gap of
+   zero bits and the frame again.  The first copy is encoded straight
+   into the radio FIFO, the rest is streamed from the frame cache while
+   the radio drains the FIFO.  The main loop is free in the meantime.
 */
-static int fht_rfm_encode(uint8_t *inbuf, uint8_t *outbuf, int insize)
-{
-  int n, nbits;
-  uint8_t byte;
-  uint8_t *outptr = outbuf;
-
-  /* Reset pushbit */
-  g_nbits = 0;
-
-  /* Extra preamble for RFM receivers - not needed if only
-   	  real FHT devices are listening */
-  for (n = 0; n < 4; n++)
-    *outptr++ = 0xaa;
-
-  /* Fill FIFO bit-by-bit to simulate 400us/600us OOK protocol */
-  for (n = 0; n < 12; n++)
-    pushbit(0, &outptr);
-  pushbit(1, &outptr);
-  for (n = 0; n < 6; n++) {
-    int parity = 0;
-    byte = inbuf[n];
-    for (nbits = 0; nbits < 8; nbits++) {
-      pushbit(byte & 0x80, &outptr);
-      parity ^= (byte / 0x80);
-      byte <<= 1;
+static uint8_t g_tx_active = 0;           // a job is on air
+static fht_frame_t *g_tx_frame;           // cached frame of the job being sent
+static uint8_t g_tx_pos;                  // bytes of the gap and second copy streamed so far
+static uint16_t g_tx_tick;                // tick the airtime below is counted in
+static uint16_t g_tx_tick_airtime;        // airtime started since the tick began [ms]
+static uint8_t g_tx_deferring = 0;        // the queue tail is held for the next tick
+
+/* Gap and second copy of the frame being sent (called from the radio ISR) */
+static uint8_t fht_tx_source(uint8_t *byte)
+{
+  if (g_tx_pos < FHT_TX_GAP_BYTES)
+    *byte = 0;
+  else if (g_tx_pos < FHT_TX_GAP_BYTES + g_tx_frame->len)
+    *byte = g_tx_frame->frame[g_tx_pos - FHT_TX_GAP_BYTES];
+  else
+    return 0;
+  g_tx_pos++;
+  return 1;
+}
+
+/* Advance the transmission of queued messages, called from the main loop */
+void fht_tx_task(void)
+{
+  fht_tx_job_t *job = &g_txq[g_txq_tail];
+  uint16_t now, airtime;
+
+  if (si443x_tx_busy())
+    return;
+
+  if (g_tx_active) {
+    LED_TRX_OFF();
+
+    /* Transmitter leaves the radio in standby */
+    fht_rx_resume();
+
+    // Log the trasmitted message
+    if (tlm_is_enabled()) {
+      tlm_fht_tx_t t;
+
+      t.group = job->group;
+      t.hc1 = job->msg.hc1;
+      t.hc2 = job->msg.hc2;
+      t.address = job->msg.address;
+      t.command = job->msg.command;
+      t.extension = job->msg.extension;
+      t.tick = fht_get_ticks();
+      tlm_send(TLM_FHT_TX, &t, sizeof(t));
+    } else {
+      LOG_FHT(0, "RFM_TX ");
+      msg_print(&job->msg, job->group, 0);
+      PRINTF("\n");
     }
-    pushbit(parity, &outptr);
+
+    g_txq_tail = (g_txq_tail + 1) & (FHT_TXQ_DIM - 1);
+    g_tx_active = 0;
+    job = &g_txq[g_txq_tail];
   }
-  pushbit(0, &outptr);
-  pushbit(0, &outptr);
 
-  return outptr - outbuf + 1;
+  if (g_txq_tail == g_txq_head)
+    return;
+
+  /* Jobs are posted at the tick and sent back to back, the airtime started
+     since then (what ran past the previous ticks included) tells how much
+     of the tick is used */
+  now = fht_get_ticks();
+  if (now != g_tx_tick) {
+    if ((uint16_t)(now - g_tx_tick) == 1 && g_tx_tick_airtime > FHT_TICK_MS)
+      g_tx_tick_airtime -= FHT_TICK_MS;
+    else
+      g_tx_tick_airtime = 0;
+    g_tx_tick = now;
+    g_tx_deferring = 0;
+  }
+
+  /* Start the next job.  Jobs are posted at the end of their timeslot
+     tick and due in the tick after it.  A sync frame due now that would
+     run into the next tick waits for it (a sync frame may be a tick late),
+     so the timeslot messages of the next tick start with the tick */
+  fht_tx_pick(now);
+  job = &g_txq[g_txq_tail];
+  airtime = FHT_TX_AIRTIME_MS(job->len);
+  if (fht_tx_is_sync(job) && (uint16_t)(now - job->tick) == 1 && g_tx_tick_airtime &&
+      g_tx_tick_airtime + airtime > FHT_TICK_MS) {
+    if (!g_tx_deferring)
+      g_txs_deferred++;
+    g_tx_deferring = 1;
+    return;
+  }
+  g_tx_tick_airtime += airtime;
+  if ((uint16_t)(now - job->tick) > 1 + fht_tx_is_sync(job))
+    g_txs_late++;
+  g_txs_sent++;
+  LED_TRX_ON();
+  si443x_tx_begin();
+  g_tx_frame = fht_frame_get(job->group, &job->msg, si443x_tx_put);
+  g_tx_pos = 0;
+  g_tx_active = 1;
+  si443x_tx_commit_stream(fht_tx_source);
 }
 
-/*!
-   Decode a buffer from FHT pulse width encoding into
-   actual byte values.  TODO: Check parity
+/*
+   Pending commands: a command enqueued while the current one has not been
+   sent yet waits in a per-group FIFO, the entries come from a pool shared
+   by all groups.  The slot handler makes the oldest one current after the
+   current command has been sent (one per slot).
+   A VALVE_SET overwrites the value of an unsent VALVE_SET for the same
+   address if nothing else has been enqueued since (latest wins), other
+   commands are kept in order.
 */
-static int fht_rfm_decode(uint8_t *inbuf, uint8_t *outbuf, int outsize)
-{
-  int inbits = 0, outbits = 0;
-  int synced = 0;
-  uint8_t symbol;
-  uint16_t outbyte = 0;
-
-  while (outsize) {
-    /* Get next undecoded 8 bits from input buffer */
-    symbol = (inbuf[0] << inbits) | (inbuf[1] >> (8 - inbits));
-
-    /* Look for valid symbol (left-justified) */
-    if ((symbol & 0xf0) == 0xc0) {
-      /* zero bit */
-      outbyte = outbyte << 1;
-      inbits += 4;
-    }
-    else if ((symbol & 0xfc) == 0xe0) {
-      /* one bit */
-      outbyte = (outbyte << 1) | 1;
-      inbits += 6;
-    }
-    else {
-      /* invalid bit pattern */
-      PRINTF("Invalid bit pattern - abort\n");
-      return -1;
-    }
 
-    /* Step input */
-    if (inbits >= 8) {
-      inbits -= 8;
-      inbuf++;
-    }
+#ifndef FHT_CMDQ_DIM
+#if FHT_GROUPS_DIM > 8
+/* A pending command per group (the boot sync queues a VALVE_SET behind the
+   SYNC of each group) and 8 more, 4 B each */
+#define FHT_CMDQ_DIM      (FHT_GROUPS_DIM + 8)
+#else
+#define FHT_CMDQ_DIM      16  // pending commands of all groups
+#endif
+#endif
+#define FHT_CMDQ_NIL      (-1)
+#define FHT_CMDQ_FREE     (-2)
+
+typedef struct {
+  uint8_t address;
+  uint8_t command;
+  uint8_t extension;
+  int8_t next;  // next pending command of the group, FHT_CMDQ_FREE if unused
+} fht_cmd_t;
+
+static fht_cmd_t g_cmdq [FHT_CMDQ_DIM] = { [0 ... FHT_CMDQ_DIM - 1] = { 0, 0, 0, FHT_CMDQ_FREE } };
+static volatile int8_t g_cmdq_head [FHT_GROUPS_DIM] = { [0 ... FHT_GROUPS_DIM - 1] = FHT_CMDQ_NIL };
+static volatile int8_t g_cmdq_tail [FHT_GROUPS_DIM] = { [0 ... FHT_GROUPS_DIM - 1] = FHT_CMDQ_NIL };
+static volatile uint8_t g_cmdq_coalesced [FHT_GROUPS_DIM];  // VALVE_SET overwritten before sent
+static volatile uint8_t g_cmdq_dropped [FHT_GROUPS_DIM];    // commands lost to a full pool
+
+/* fht_cmdq_put() results */
+#define FHT_CMDQ_CURRENT    0  // the command is current
+#define FHT_CMDQ_COALESCED  1  // an unsent VALVE_SET took the new value
+#define FHT_CMDQ_QUEUED     2  // appended to the pending commands
+#define FHT_CMDQ_DROPPED    3  // no room in the pool
+
+/* Make the command current */
+static void fht_grp_set_cmd(grp_indx_t group, uint8_t address, uint8_t command, uint8_t value)
+{
+  g_grp_addr[group] = address;
+  g_grp_cmd[group] = FHT_EXT_PRESENT | (command & 0xf);
+  g_grp_ext[group] = value;
+  if ((command & 0xf) == FHT_SYNC)
+    g_slot_count[group] = SYNC_TICKS | 1;
+}
 
-    /* Don't start shifting bits out until after we have seen the first
-     		  1 bit at the end of the preamble */
-    if (!synced) {
-      if (outbyte & 1)
-        synced = 1;
-      continue;
-    }
+static uint8_t fht_cmdq_count(grp_indx_t group)
+{
+  int8_t n;
+  uint8_t count = 0;
+
+  /* (n >= 0 also stops at an entry freed meanwhile by the interrupt) */
+  for (n = g_cmdq_head[group]; n >= 0; n = g_cmdq[n].next)
+    count++;
+  return count;
+}
 
-    /* Step output */
-    if (++outbits == 9) {
-      *outbuf++ = (outbyte >> 1); /* remove parity bit */
-      outsize--;
-      outbits = 0;
+/* Store the command according to the rules above (interrupts must be disabled) */
+static uint8_t fht_cmdq_put(grp_indx_t group, uint8_t address, uint8_t command, uint8_t value)
+{
+  /* Current command already sent (or none set yet) */
+  uint8_t done = (g_grp_cmd[group] & FHT_REPEAT) || g_grp_cmd[group] == 0;
+  int8_t n;
+
+  if (command == FHT_VALVE_SET) {
+    /* Only the last unsent command may take the new value, the commands
+       enqueued before this one stay ahead of it */
+    n = g_cmdq_tail[group];
+    if (n != FHT_CMDQ_NIL) {
+      if (g_cmdq[n].command == FHT_VALVE_SET && g_cmdq[n].address == address) {
+        g_cmdq[n].extension = value;
+        goto coalesced;
+      }
+    } else if (!done && (g_grp_cmd[group] & 0xf) == FHT_VALVE_SET && g_grp_addr[group] == address) {
+      g_grp_ext[group] = value;
+      goto coalesced;
     }
   }
 
-  return 0;
+  if (done && g_cmdq_head[group] == FHT_CMDQ_NIL) {
+    fht_grp_set_cmd(group, address, command, value);
+    return FHT_CMDQ_CURRENT;
+  }
+
+  for (n = 0; n < FHT_CMDQ_DIM; n++)
+    if (g_cmdq[n].next == FHT_CMDQ_FREE)
+      break;
+  if (n == FHT_CMDQ_DIM) {
+    if (g_cmdq_dropped[group] < 0xff)
+      g_cmdq_dropped[group]++;
+    return FHT_CMDQ_DROPPED;
+  }
+  g_cmdq[n].address = address;
+  g_cmdq[n].command = command;
+  g_cmdq[n].extension = value;
+  g_cmdq[n].next = FHT_CMDQ_NIL;
+  if (g_cmdq_tail[group] == FHT_CMDQ_NIL)
+    g_cmdq_head[group] = n;
+  else
+    g_cmdq[g_cmdq_tail[group]].next = n;
+  g_cmdq_tail[group] = n;
+  return FHT_CMDQ_QUEUED;
+
+coalesced:
+  if (g_cmdq_coalesced[group] < 0xff)
+    g_cmdq_coalesced[group]++;
+  return FHT_CMDQ_COALESCED;
 }
 
-#define FHT_BUFFER_SIZE	64
+/* The current command has been sent, make the oldest pending one current
+   (called from ISR) */
+static void fht_cmdq_pop(grp_indx_t group)
+{
+  int8_t n = g_cmdq_head[group];
+
+  if (n == FHT_CMDQ_NIL)
+    return;
+  g_cmdq_head[group] = g_cmdq[n].next;
+  if (g_cmdq_head[group] == FHT_CMDQ_NIL)
+    g_cmdq_tail[group] = FHT_CMDQ_NIL;
+  fht_grp_set_cmd(group, g_cmdq[n].address, g_cmdq[n].command, g_cmdq[n].extension);
+  g_cmdq[n].next = FHT_CMDQ_FREE;
+}
 
-static void fht_transmit(uint8_t group)
+/* Return the pending commands of the group to the pool (interrupts must be disabled) */
+static void fht_cmdq_clear(grp_indx_t group)
 {
-  uint8_t *_msg = (uint8_t*) & (g_message[group]);
-  int n, length;
-  /* Output buffer for variable length bitstream
-   	  The preamble is always 54 actual bits long (12 0's and a 1)
-   	  The payload is 54 bits - maximum actual length = 54x6 = 324 bits
-   	  Terminates with two 0's = 8 bits
-   	  Maximum buffer size therefore = 49 bytes + 4 for extra preamble
-  */
-  uint8_t outbuf[FHT_BUFFER_SIZE];
+  int8_t n = g_cmdq_head[group], next;
 
-  LED_TRX_ON();
+  while (n != FHT_CMDQ_NIL) {
+    next = g_cmdq[n].next;
+    g_cmdq[n].next = FHT_CMDQ_FREE;
+    n = next;
+  }
+  g_cmdq_head[group] = FHT_CMDQ_NIL;
+  g_cmdq_tail[group] = FHT_CMDQ_NIL;
+}
 
-  /* Clear output buffer */
-  memset(outbuf, 0, FHT_BUFFER_SIZE);
+/*
+   Timing wheel: each group sits in the bucket of the tick at which it needs
+   attention next, so a tick only visits the groups that are due (and the
+   few that wrapped around the wheel).  Buckets are kept sorted by group
+   index, due groups are served in the same order as the original scan.
+*/
 
-  /* Calculate checksum */
-  g_message[group].checksum = 0x0c;
-  for (n = 0; n < 5; n++) {
-    g_message[group].checksum += _msg[n];
-  }
+#define FHT_WHEEL_DIM   32  // must be a power of 2
+#define FHT_WHEEL_NIL   (-1)
+
+/* Group events, the normal ones in the order they come within a period */
+#define FHT_EV_TEMP     0     // 4 ticks before the timeslot: start temperature measurement (group 0 only)
+#define FHT_EV_FREEZE   1     // 2 ticks before the timeslot: freezing protection
+#define FHT_EV_TX       2     // timeslot: transmit the stored message
+#define FHT_EV_CMD      3     // every tick: sync countdown, pairing or leaving them
+#define FHT_EV_LINKED   0x80  // flag: the group is in the wheel
+
+static volatile grp_indx_t g_wheel [FHT_WHEEL_DIM] = { [0 ... FHT_WHEEL_DIM - 1] = FHT_WHEEL_NIL };
+static volatile grp_indx_t g_wheel_next [FHT_GROUPS_DIM];
+static volatile uint16_t g_due [FHT_GROUPS_DIM];
+static volatile uint8_t g_event [FHT_GROUPS_DIM];
 
-  /* Dump un-encoded message */
-  // hexdump(_msg, sizeof(fht_msg_t));
+/* Take the group out of the wheel (interrupts must be disabled) */
+static void fht_wheel_remove(grp_indx_t group)
+{
+  volatile grp_indx_t *link = &g_wheel[g_due[group] & (FHT_WHEEL_DIM - 1)];
+
+  if (!(g_event[group] & FHT_EV_LINKED))
+    return;
+  while (*link != group)
+    link = &g_wheel_next[*link];
+  *link = g_wheel_next[group];
+  g_event[group] &= ~FHT_EV_LINKED;
+}
 
-  /* Dump encoded message */
-  length = fht_rfm_encode(_msg, outbuf, sizeof(fht_msg_t));
-  //if (DEBUG > 1) hexdump(outbuf, length);
+/* (Re)schedule the group event at the given tick (interrupts must be disabled) */
+static void fht_wheel_insert(grp_indx_t group, uint16_t due, uint8_t event)
+{
+  volatile grp_indx_t *link = &g_wheel[due & (FHT_WHEEL_DIM - 1)];
+
+  fht_wheel_remove(group);
+  while (*link != FHT_WHEEL_NIL && *link < group)
+    link = &g_wheel_next[*link];
+  g_wheel_next[group] = *link;
+  *link = group;
+  g_due[group] = due;
+  g_event[group] = event | FHT_EV_LINKED;
+}
 
-  /* Transmit twice */
-  si443x_transmit(outbuf, length);
-  /* This delay is about right with debug enabled.  The actual gap
-   	  should be about 8 ms */
-  _delay_ms(5);
-  si443x_transmit(outbuf, length);
+/* Schedule the period ending with the timeslot at the given tick,
+   events that are already past are skipped */
+static void fht_wheel_period(grp_indx_t group, uint16_t slot_tick)
+{
+  if (group == 0 && (int16_t)(slot_tick - 4 - g_ticks) > 0)
+    fht_wheel_insert(group, slot_tick - 4, FHT_EV_TEMP);
+  else if ((int16_t)(slot_tick - 2 - g_ticks) > 0)
+    fht_wheel_insert(group, slot_tick - 2, FHT_EV_FREEZE);
+  else
+    fht_wheel_insert(group, slot_tick, FHT_EV_TX);
+}
 
-  LED_TRX_OFF();
+/* Let the next tick look at the group command (sync, pair) */
+static void fht_wheel_kick(grp_indx_t group)
+{
+  uint8_t sreg = SREG;
 
-  // Log the trasmitted message
-  LOG_FHT("0 RFM_TX ");
-  msg_enq_print(group, 0);
-  PRINTF("\n");
+  cli();
+  fht_wheel_insert(group, g_ticks, FHT_EV_CMD);
+  SREG = sreg;
 }
 
 /* Init fht and read the configuration */
@@ -346,17 +746,19 @@ void fht_init(void)
 {
   int r, g;
   cli();
-  r = fht_eeprom_load(g_message);
+  r = fht_eeprom_load();
   sei();
   if (r < 0)
-    LOG_FHT("1 EEPROM incosistent configuration data from EEPROM ignored\n")
+    LOG_FHT(1, "EEPROM incosistent configuration data from EEPROM ignored\n")
     else
     {
       PRINTF("Config loaded from eeprom, %d groups found.\n", r);
       g_groups_num = r;
       for (g = 0; g < r; g++)
-        LOG_FHT("1 EEPROM Group %d HC is %d %d = 0x%X 0x%X.\n", grp_indx2name(g),  g_message[g].hc1, g_message[g].hc2,  g_message[g].hc1, g_message[g].hc2);
+        LOG_FHT(1, "EEPROM Group %d HC is %d %d = 0x%X 0x%X.\n", grp_indx2name(g),  g_grp_hc1[g], g_grp_hc2[g],  g_grp_hc1[g], g_grp_hc2[g]);
     }
+  for (g = 0; g < g_groups_num; g++)
+    fht_wheel_kick(g);
 }
 
 
@@ -367,24 +769,65 @@ grp_indx_t fht_get_groups_num(void)
 
 void fht_set_groups_num(grp_name_t groupsnum)
 {
+  grp_indx_t g, old = g_groups_num;
+  uint8_t sreg = SREG;
+
+  /* New groups start their period, removed ones drop out of the wheel and
+     give their pending commands back to the pool */
+  cli();
   g_groups_num = groupsnum;
+  for (g = g_groups_num; g < old; g++)
+    fht_cmdq_clear(g);
+  SREG = sreg;
+  for (g = old; g < g_groups_num; g++)
+    fht_wheel_kick(g);
   fht_eeprom_save_header(g_groups_num);
 }
 
 
-void msg_enq_print(grp_indx_t group, int8_t verb)
+static void msg_print(fht_msg_t *msg, grp_indx_t group, int8_t verb)
 {
-  PRINTF("CMD='"); cmddump(&(g_message[group]));      PRINTF("' ");
-  PRINTF("FLG='"); cmdflagsdump(&(g_message[group])); PRINTF("' ");
-  PRINTF("grp='%d' adr='%u' ", grp_indx2name(group),  g_message[group].address);
+  PRINTF("CMD='"); cmddump(msg);      PRINTF("' ");
+  PRINTF("FLG='"); cmdflagsdump(msg); PRINTF("' ");
+  PRINTF("grp='%d' adr='%u' ", grp_indx2name(group),  msg->address);
   if (verb > 0) {
     PRINTF(" hc='%u %u'='0x%X 0x%X' cmdL='0x0x%X' cmdU='0x0x%X' ext='0x0x%X' ",
-           g_message[group].hc1, g_message[group].hc2,
-           g_message[group].hc1, g_message[group].hc2,
-           g_message[group].command & 0xf, (g_message[group].command & 0xf0) >> 4, g_message[group].extension);
+           msg->hc1, msg->hc2,
+           msg->hc1, msg->hc2,
+           msg->command & 0xf, (msg->command & 0xf0) >> 4, msg->extension);
   }
 }
 
+void msg_enq_print(grp_indx_t group, int8_t verb)
+{
+  fht_msg_t msg;
+
+  fht_grp_msg(group, &msg);
+  msg_print(&msg, group, verb);
+}
+
+/* Stack and CLI headroom to be kept free when adding groups */
+#define FHT_RAM_RESERVE		256
+
+/* RAM budget: what the groups cost (rounded up) and how many more would
+   fit, each with a command pool entry (see FHT_CMDQ_DIM) */
+static void fht_print_ram(void)
+{
+  uint16_t per_group = (sizeof(g_grp_hc1) + sizeof(g_grp_hc2) + sizeof(g_grp_addr) +
+                        sizeof(g_grp_cmd) + sizeof(g_grp_ext) + sizeof(g_slot_count) + sizeof(g_grp_syncing) +
+                        sizeof(g_wheel_next) + sizeof(g_due) + sizeof(g_event) +
+                        sizeof(g_cmdq_head) + sizeof(g_cmdq_tail) +
+                        sizeof(g_cmdq_coalesced) + sizeof(g_cmdq_dropped) +
+                        sizeof(g_log_all_dropped) + 7) / FHT_GROUPS_DIM + sizeof(fht_cmd_t);
+  int mem = freeMemory();
+
+  PRINTF("RAM per group: %u B, %u groups: %u B; frame cache: %u x %u B; TX queue: %u B; command pool: %u B\n",
+         per_group, FHT_GROUPS_DIM, per_group * FHT_GROUPS_DIM,
+         FHT_FRAME_CACHE_DIM, sizeof(fht_frame_t), sizeof(g_txq), sizeof(g_cmdq));
+  PRINTF("About %d more groups would fit (FHT_GROUPS_DIM), keeping %u B for stack and CLI\n",
+         mem > FHT_RAM_RESERVE ? (mem - FHT_RAM_RESERVE) / per_group : 0, FHT_RAM_RESERVE);
+}
+
 /* current setting report */
 void fht_print(void) {
   int g;
@@ -396,14 +839,16 @@ void fht_print(void) {
   fht_eeprom_print();
 
   PRINTF("\n*** Messages enqueued:\n");
-  for (g = 0; g < g_groups_num; g++) {
-    LOG_FHT("1 RFM_TQ ");
+  for (g = 0; g < g_groups_num && LOG_ENABLED(1); g++) {
+    LOG_FHT(1, "RFM_TQ ");
     msg_enq_print(g, DEBUG);
     PRINTF("\n");
   }
 
   PRINTF("\n*** Technical report:\n");
   PRINTF("Free mem is %u\n", freeMemory());
+  fht_print_ram();
+  PRINTF("TX jobs queued: %u, dropped: %u\n", (g_txq_head - g_txq_tail) & (FHT_TXQ_DIM - 1), g_txq_dropped);
   if (fht_is_panic()) PRINTF("Panic! ");
   PRINTF("Uptime [ticks]: %u; last enq command at: %u\n", g_ticks, g_last_command_enqueued_time);
   if (g_freezingMode>0) PRINTF("Freezing! ");
@@ -413,11 +858,11 @@ void fht_print(void) {
 
   m328_print_readings();
   if (si443x_status() == 0) {
-    LOG_FHT("1 RADIO ok\n");
+    LOG_FHT(1, "RADIO ok\n");
     // si443x_dump();
   }
   else {
-    LOG_FHT("1 RADIO FAILED status is %d.\n", si443x_status());
+    LOG_FHT(1, "RADIO FAILED status is %d.\n", si443x_status());
   }
 
   PRINTF("SETTINGS: FHT_FREEZING_TEMP=%d, FHT_FREEZING_SET_VALUE=0x%X, FREEZING_INIT_COUNT=%u; FHT_PANIC_TIMEOUT=%u[ticks], FHT_PANIC_SET_VALUE=0x%X\n",
@@ -428,7 +873,7 @@ void fht_print(void) {
 void fht_config_save_group(grp_indx_t group)
 {
   cli();
-  fht_eeprom_save_group(group, &(g_message[group]));
+  fht_eeprom_save_group(group, g_grp_hc1[group], g_grp_hc2[group]);
   sei();
 }
 
@@ -440,7 +885,7 @@ void fht_clear_panic_count(void) {
 /* cancel panic (if any) and clear panic counter*/
 void fht_cancel_panic(void) {
   if (fht_is_panic()) {
-    LOG_FHT("0 PANIC OFF tick='%u' last_enq='%u' pos='%u'\n", g_ticks, g_last_command_enqueued_time, FHT_PANIC_SET_VALUE);
+    LOG_FHT(0, "PANIC OFF tick='%u' last_enq='%u' pos='%u'\n", g_ticks, g_last_command_enqueued_time, FHT_PANIC_SET_VALUE);
     LOG_CLI("PANIC OFF");
   }
   fht_clear_panic_count();
@@ -451,239 +896,700 @@ bool_t fht_is_panic(void) {
   return g_ticks  >=  g_last_command_enqueued_time + FHT_PANIC_TIMEOUT ;
 }
 
+/* Serve the groups due at g_ticks */
+static void fht_tick_wheel(void)
+{
+  volatile grp_indx_t *link = &g_wheel[g_ticks & (FHT_WHEEL_DIM - 1)];
+  grp_indx_t group, due [FHT_GROUPS_DIM];
+  uint8_t n, ndue = 0;
+
+  g_tick_airtime = 0;
+
+  /* Unlink the due groups first, their handlers reschedule them */
+  while ((group = *link) != FHT_WHEEL_NIL) {
+    if (g_due[group] == g_ticks) {
+      *link = g_wheel_next[group];
+      g_event[group] &= ~FHT_EV_LINKED;
+      due[ndue++] = group;
+    } else {
+      link = &g_wheel_next[group];
+    }
+  }
+  for (n = 0; n < ndue; n++) {
+    /* groups removed by fht groups drop out of the wheel */
+    if (due[n] < g_groups_num)
+      fht_tick_grp(due[n]);
+  }
+
+  if (g_tick_airtime > g_tick_airtime_max)
+    g_tick_airtime_max = g_tick_airtime;
+  if (g_tick_airtime > FHT_TICK_MS)
+    g_ticks_overbooked++;
+}
+
+/* Take one lost tick to catch up, if any */
+static uint8_t fht_tick_catch_up(void)
+{
+  uint8_t sreg = SREG, r = 0;
+
+  cli();
+  if (g_ticks_missed) {
+    g_ticks_missed--;
+    r = 1;
+  }
+  SREG = sreg;
+  return r;
+}
+
+/* The timer interrupt lost ticks while fht_tick() was running, they are
+   served by the next fht_tick() (called from ISR) */
+void fht_tick_missed(uint8_t n)
+{
+  g_ticks_lost += n;
+  g_ticks_missed += n;
+}
+
+/* fht_tick() took longer than the tick period, ticks were lost */
+void fht_tick_overrun(void)
+{
+  g_tick_overruns++;
+}
+
+void fht_print_stats(void)
+{
+  grp_indx_t g;
+
+  PRINTF("\n*** TX arbiter stats:\n");
+  PRINTF("TX jobs sent: %u, late: %u, reordered: %u, deferred: %u, dropped: %u, queued: %u, max queued: %u\n",
+         g_txs_sent, g_txs_late, g_txs_reordered, g_txs_deferred, g_txq_dropped,
+         (g_txq_head - g_txq_tail) & (FHT_TXQ_DIM - 1), g_txs_max_queued);
+  PRINTF("Airtime per tick [ms]: max %u, ticks overbooked: %u (tick is %u ms)\n",
+         g_tick_airtime_max, g_ticks_overbooked, FHT_TICK_MS);
+  PRINTF("Tick overruns: %u, lost ticks caught up: %u\n", g_tick_overruns, g_ticks_lost);
+  PRINTF("Radio FIFO underruns (frames sent truncated): %u\n", si443x_tx_underruns());
+  PRINTF("Event log records dropped: %u (log of %u)\n", evlog_dropped(), EVLOG_DIM);
+
+  PRINTF("\n*** Pending commands (pool of %u):\n", FHT_CMDQ_DIM);
+  for (g = 0; g < g_groups_num; g++)
+    PRINTF("grp='%d' pend='%u' coalesced='%u' dropped='%u' syncing='%u'\n", grp_indx2name(g),
+           fht_cmdq_count(g), g_cmdq_coalesced[g], g_cmdq_dropped[g], g_grp_syncing[g]);
+}
+
+/* Format a recorded RFM_TQ event */
+static void fht_log_rfm_tq(evlog_rec_t *rec)
+{
+  fht_msg_t msg;
+
+  if (tlm_is_enabled()) {
+    tlm_fht_tq_t t;
+
+    t.group = rec->group;
+    t.address = rec->arg[1] >> 8;
+    t.command = rec->arg[0] >> 8;
+    t.extension = rec->arg[0] & 0xff;
+    t.dropped = (rec->id == FHT_LOG_RFM_TQ_DROP);
+    t.pending = rec->arg[1] & 0xff;
+    t.tick = rec->tick;
+    tlm_send(TLM_FHT_TQ, &t, sizeof(t));
+    return;
+  }
+  fht_grp_msg(rec->group, &msg);
+  msg.address = rec->arg[1] >> 8;
+  msg.command = rec->arg[0] >> 8;
+  msg.extension = rec->arg[0] & 0xff;
+  if (rec->id == FHT_LOG_RFM_TQ_DROP)
+    LOG_FHT(0, "RFM_TQ_DROP ")
+  else
+    LOG_FHT(0, "RFM_TQ ");
+  msg_print(&msg, rec->group, 0);
+  PRINTF("pend='%u'\n", rec->arg[1] & 0xff);
+}
+
+/* Format a recorded freezing protection event */
+static void fht_log_freezing(evlog_rec_t *rec)
+{
+  int16_t t10 = rec->arg[0];
+
+  if (tlm_is_enabled()) {
+    tlm_freeze_t t;
+
+    t.event = rec->id - FHT_LOG_FREEZING_ENTER + TLM_FREEZE_ENTER;
+    t.group = rec->group;
+    t.t10 = t10;
+    t.tick = rec->tick;
+    tlm_send(TLM_FREEZE, &t, sizeof(t));
+  } else if (rec->id == FHT_LOG_FREEZING_ENTER) {
+    LOG_FHT(0, "FREEZING ENTER lastT10='%d' tick='%u'\n", t10, rec->tick);
+  } else if (rec->id == FHT_LOG_FREEZING_LEAVE) {
+    LOG_FHT(0, "FREEZING LEAVE lastT10='%d tick='%u''\n", t10, rec->tick);
+  } else {
+    LOG_FHT(0, "FREEZING TX enforcing group='%u' valve opening to 0x%X\n", grp_indx2name(rec->group), FHT_FREEZING_SET_VALUE);
+  }
+}
+
+/* Format a recorded sync event */
+static void fht_log_sync(evlog_rec_t *rec)
+{
+  if (tlm_is_enabled()) {
+    tlm_fht_sync_t t;
+
+    t.event = rec->id - FHT_LOG_SYNC_START + TLM_SYNC_START;
+    t.group = rec->group;
+    t.count = rec->arg[0];
+    t.tick = rec->tick;
+    tlm_send(TLM_FHT_SYNC, &t, sizeof(t));
+  } else if (rec->id == FHT_LOG_SYNC_START) {
+    LOG_FHT(1, "RFM_TX SYNC START grp='%d' tick='%u'\n", grp_indx2name(rec->group), rec->tick);
+  } else if (rec->id == FHT_LOG_SYNC_PROGRESS) {
+    LOG_FHT(1, "RFM_TX SYNC PROGRESS grp='%d' cnt='%u' tick='%u'\n", grp_indx2name(rec->group), rec->arg[0], rec->tick);
+  } else {
+    LOG_FHT(0, "RFM_TX SYNC DONE grp='%d' tick='%u'\n", grp_indx2name(rec->group), rec->tick);
+  }
+}
+
+/* Print a recorded event */
+static void fht_log_rec(evlog_rec_t *rec)
+{
+  switch (rec->id) {
+    case FHT_LOG_RFM_TQ:
+    case FHT_LOG_RFM_TQ_DROP:
+      fht_log_rfm_tq(rec);
+      break;
+    case FHT_LOG_PANIC_ON:
+      LOG_FHT(0, "PANIC ON tick='%u' last_enq='%u' pos='%u'\n", rec->tick, rec->arg[0], FHT_PANIC_SET_VALUE);
+      LOG_CLI("PANIC ON setting all groups valve positions to 0x%X : message enqueued.\n", FHT_PANIC_SET_VALUE);
+      break;
+    case FHT_LOG_FREEZING_ENTER:
+    case FHT_LOG_FREEZING_LEAVE:
+    case FHT_LOG_FREEZING_TX:
+      fht_log_freezing(rec);
+      break;
+    case FHT_LOG_TICK_IGNORED:
+      LOG_CLI("fht_tick ignored,  radio not intialized.\n");
+      break;
+    case FHT_LOG_SYNC_START:
+    case FHT_LOG_SYNC_PROGRESS:
+    case FHT_LOG_SYNC_DONE:
+      fht_log_sync(rec);
+      break;
+  }
+}
+
+/* Print a record of all the groups, as a record of each group: an RFM_TQ
+   one is RFM_TQ_DROP for the groups whose command was dropped and gives
+   the commands pending when printed */
+static void fht_log_all(evlog_rec_t *rec)
+{
+  evlog_rec_t r = *rec;
+  uint8_t sreg = SREG, bit;
+
+  for (r.group = 0; r.group < g_groups_num; r.group++) {
+    if (rec->id == FHT_LOG_RFM_TQ) {
+      bit = 1 << (r.group & 7);
+      cli();
+      r.id = g_log_all_dropped[r.group >> 3] & bit ? FHT_LOG_RFM_TQ_DROP : FHT_LOG_RFM_TQ;
+      g_log_all_dropped[r.group >> 3] &= ~bit;
+      r.arg[1] = (rec->arg[1] & 0xff00) | fht_cmdq_count(r.group);
+      SREG = sreg;
+    }
+    fht_log_rec(&r);
+  }
+}
+
+/* Print the events recorded by the tick interrupt, called from the main loop */
+void fht_log_task(void)
+{
+  evlog_rec_t rec;
+
+  while (evlog_get(&rec)) {
+    if (rec.group == FHT_LOG_ALL)
+      fht_log_all(&rec);
+    else
+      fht_log_rec(&rec);
+  }
+}
+
 /* Called once every 500 ms from ISR */
 void fht_tick(void) // HB
 {
   LED_GREEN_ON();
   if (fht_is_panic()) { // panic?
-    LOG_FHT("0 PANIC ON tick='%u' last_enq='%u' pos='%u'\n", g_ticks, g_last_command_enqueued_time, FHT_PANIC_SET_VALUE);
-    LOG_CLI("PANIC ON setting all groups valve positions to 0x%X : message enqueued.\n", FHT_PANIC_SET_VALUE);
+    evlog_put(FHT_LOG_PANIC_ON, 0, g_ticks, g_last_command_enqueued_time, 0);
     fht_enqueue(grp_indx_all, 0, FHT_VALVE_SET, FHT_PANIC_SET_VALUE);
     fht_clear_panic_count();
     LED_RED_ON();
   }
 
   if (si443x_status() == 0) {
-    grp_indx_t group;
-    for (group = 0; group < g_groups_num; group++) {
-      fht_tick_grp(group);
-    }
-    g_ticks++;
+    /* Ticks lost by the timer interrupt are caught up, the timeslots
+       stay in step with the valves */
+    do {
+      fht_tick_wheel();
+      g_ticks++;
+    } while (fht_tick_catch_up());
   } else {
     LED_RED_ON();
-    LOG_CLI("fht_tick ignored,  radio not intialized.\n");
+    evlog_put(FHT_LOG_TICK_IGNORED, 0, g_ticks, 0, 0);
   }
   LED_GREEN_OFF();
 }
 
+/* Handle the due event of the group and schedule the next one (called from ISR) */
 void fht_tick_grp(grp_indx_t group)
 {
   /* Transmit slot depends on HC2 byte */
-  int slot = (g_message[group]).hc2 & 7;
+  int slot = g_grp_hc2[group] & 7;
+  uint8_t event = g_event[group];
+
+  /* Our timeslot and the current command has been sent - the next pending
+     one takes its place */
+  if ((event & ~FHT_EV_LINKED) == FHT_EV_TX && (g_grp_cmd[group] & FHT_REPEAT))
+    fht_cmdq_pop(group);
 
-  if (((g_message[group]).command & 0xf) == FHT_SYNC) {
+  if ((g_grp_cmd[group] & 0xf) == FHT_SYNC) {
     /* Sync message is sent once per second for 2 minutes */
     if (g_slot_count[group] & 1) {
       /* transmit sync */
-      //--//LOG_FHT("1 RFM_TX SYNC %u group %d sync %d\n", g_ticks, grp_indx2name(group), g_slot_count[group]);
-      (g_message[group]).extension = g_slot_count[group];
-      fht_transmit(group);
+      //--//LOG_FHT(1, "RFM_TX SYNC %u group %d sync %d\n", g_ticks, grp_indx2name(group), g_slot_count[group]);
+      g_grp_ext[group] = g_slot_count[group];
+      fht_post_tx(group);
+      /* Every 32 seconds */
+      if ((g_slot_count[group] & 0x3f) == 1)
+        evlog_put(FHT_LOG_SYNC_PROGRESS, group, g_ticks, g_slot_count[group], 0);
     }
     if (--g_slot_count[group] < 3) {
       /* We don't send the '0' sync count - we are now at 4 seconds before
        			  the first slot */
-      g_slot_count[group] = PERIOD_BASE - 8;
+      fht_wheel_period(group, g_ticks + 8 + slot);
 
       /* First actual message - will be sent when the correct timeslot is reached */
-      (g_message[group]).command = FHT_EXT_PRESENT | FHT_SYNC_SET;
-      (g_message[group]).extension = FHT_SYNC_SET_VALUE; // probably not working, my valves are set to 0 ignoring this parameter
+      g_grp_cmd[group] = FHT_EXT_PRESENT | FHT_SYNC_SET;
+      g_grp_ext[group] = FHT_SYNC_SET_VALUE; // probably not working, my valves are set to 0 ignoring this parameter
+    } else {
+      fht_wheel_insert(group, g_ticks + 1, FHT_EV_CMD);
     }
+    return;
   }
-  else if (((g_message[group]).command & 0xf) == FHT_PAIR) {
-    //--//LOG_FHT("1 RFM_TX PAIR group %d hc %d %d tick %u slot %d tx\n",  grp_indx2name(group), (g_message[group]).hc1,  (g_message[group]).hc2, g_ticks, slot);
+
+  if ((g_grp_cmd[group] & 0xf) == FHT_PAIR) {
+    //--//LOG_FHT(1, "RFM_TX PAIR group %d hc %d %d tick %u slot %d tx\n",  grp_indx2name(group), g_grp_hc1[group],  g_grp_hc2[group], g_ticks, slot);
     g_slot_count[group] = 0;
-    fht_transmit(group);
+    fht_post_tx(group);
+    fht_wheel_period(group, g_ticks + PERIOD_BASE + slot);
     /* First actual message - will be sent when the correct timeslot is reached */
-    (g_message[group]).command = FHT_EXT_PRESENT | FHT_SYNC_SET;
-    (g_message[group]).extension = 0;
+    g_grp_cmd[group] = FHT_EXT_PRESENT | FHT_SYNC_SET;
+    g_grp_ext[group] = 0;
+    return;
   }
-  else {
-    g_slot_count[group]++;
 
-    if (g_slot_count[group] == PERIOD_BASE + slot - 4) {
+  switch (event & ~FHT_EV_LINKED) {
+    case FHT_EV_CMD: {
+      /* Normal operation (re)starts, the slot counter has counted
+         g_slot_count ticks of the period already */
+      uint16_t slot_tick = g_ticks + PERIOD_BASE + slot - g_slot_count[group] - 1;
+
+      if ((int16_t)(slot_tick - g_ticks) > 0) {
+        fht_wheel_period(group, slot_tick);
+        break;
+      }
+      /* the timeslot has been missed, transmit now - a sent command gives
+         way to the next pending one as in FHT_EV_TX */
+      if (g_grp_cmd[group] & FHT_REPEAT)
+        fht_cmdq_pop(group);
+    }
+    /* no break */
+    case FHT_EV_TX:
+      /* This is our timeslot - SEND the stored MESSAGE */
+
+      // LOG_FHT(1, "TIME tick='%u' slot='%u'\n", g_ticks, slot);
+
+      // FHEM FHT_HB.classdef code to catch and parse last transmitted state:
+      // reading pos_tx  match       "^LOG FHT \d RFM_TX CMD='VALVE_SET (\d+)' .* grp='%group_idx'.*$"
+      // reading pos_tx  postproc { s/^LOG FHT \d RFM_TX CMD='VALVE_SET (\d+)' .* grp='%group_idx'.*$/$1/;; floor($_/255*100) }
+
+      // reset timeslot counter
+      g_slot_count[group] = 0;
+      fht_wheel_period(group, g_ticks + PERIOD_BASE + slot);
+
+      // transmit message
+      fht_post_tx(group);
+
+      /* The first message after the sync countdown completes the sync */
+      if (g_grp_syncing[group] && !(g_grp_cmd[group] & FHT_REPEAT)) {
+        g_grp_syncing[group] = 0;
+        evlog_put(FHT_LOG_SYNC_DONE, group, g_ticks, 0, 0);
+      }
+
+      /* Set the repeat flag for next time */
+      g_grp_cmd[group] |= FHT_REPEAT;
+      break;
+
+    case FHT_EV_TEMP:
       //DPRINTF("Four ticks before the group %u timeslot (tick=%u) free mem is %u,  requesting temperatures measurement.\n",  grp_indx2name(group), g_ticks, freeMemory());
       if (group == 0) {
         temp_request_start();
       };
-    }
-    else if (g_slot_count[group] == PERIOD_BASE + slot - 2) {
+      fht_wheel_insert(group, g_ticks + 2, FHT_EV_FREEZE);
+      break;
+
+    case FHT_EV_FREEZE: {
       //DPRINTF("Two  ticks before the group %u timeslot (tick=%u) free mem is %u, temperatures are:\n",  grp_indx2name(group), g_ticks, freeMemory());
       //PRINTF("Two ticks before the group %u timeslot temperatures (tick=%u) are:\n",  grp_indx2name(group), g_ticks);
       ///// freezing protection
       // detection of freezing is done in group 0 ONLY
       int16_t lastT10 = TEMP_NA;
+      fht_wheel_insert(group, g_ticks + 2, FHT_EV_TX);
       if (group == 0) {
-        // print and save measured group 0 temp
-        lastT10 = temp_request_print();
+        // last measurement completed by temp_task() (requested at FHT_EV_TEMP),
+        // the sensors are not touched here
+        lastT10 = temp_get_snapshot_t10();
         // update freezingMode
-        if (lastT10 <= ((int16_t)(10 * FHT_FREEZING_TEMP))) { // is freezing
-          if (g_freezingMode == 0) LOG_FHT("0 FREEZING ENTER lastT10='%d' tick='%u'\n", lastT10, g_ticks);
+        if (lastT10 == TEMP_NA) {
+          // no measurement yet, keep the mode
+        }
+        else if (lastT10 <= ((int16_t)(10 * FHT_FREEZING_TEMP))) { // is freezing
+          if (g_freezingMode == 0) evlog_put(FHT_LOG_FREEZING_ENTER, group, g_ticks, lastT10, 0);
           g_freezingMode = FREEZING_INIT_COUNT;
           LED_RED_ON();
         }
         else { // not freezing
-          if (g_freezingMode == 1) LOG_FHT("0 FREEZING LEAVE lastT10='%d tick='%u''\n", lastT10, g_ticks);
+          if (g_freezingMode == 1) evlog_put(FHT_LOG_FREEZING_LEAVE, group, g_ticks, lastT10, 0);
           if (g_freezingMode > 0)  g_freezingMode--;
         }
       }
       // if freezing mode is enabled, do the protecting work in CURRENT group
-      if ((g_freezingMode > 0) && (((g_message[group]).command & 0xf) == FHT_VALVE_SET) && ((g_message[group]).extension < FHT_FREEZING_SET_VALUE)) {
+      if ((g_freezingMode > 0) && ((g_grp_cmd[group] & 0xf) == FHT_VALVE_SET) && (g_grp_ext[group] < FHT_FREEZING_SET_VALUE)) {
         // Open  valves minimally to FHT_FREEZING_SET_VALUE
-        LOG_FHT("0 FREEZING TX enforcing group='%u' valve opening to 0x%X\n", grp_indx2name(group), FHT_FREEZING_SET_VALUE);
+        evlog_put(FHT_LOG_FREEZING_TX, group, g_ticks, lastT10, 0);
         fht_enqueue(group, 0, FHT_VALVE_SET, FHT_FREEZING_SET_VALUE);  // modify FHT_VALVE_SET message to be transmitted
       }
+      break;
     }
-    else if (g_slot_count[group] == PERIOD_BASE + slot) {
-      /* This is our timeslot - SEND the stored MESSAGE */
+  }
+}
 
-      // LOG_FHT("1 TIME tick='%u' slot='%u'\n", g_ticks, slot);
+/* Tick of the timeslot sending the command enqueued last to the group, as
+   the wheel and the queue stand now (interrupts must be disabled).  It is an
+   estimate, it does not cover:
+   - a sync or pair enqueued later, it pushes the command back
+   - a later VALVE_SET taking the value of this one, which is then never sent
+   - a new home code or number of groups, they move the timeslot
+   - the SYNC_SET of a sync deferred by fht_tx_task() to the next tick
+   The commands of the groups in their normal timeslots are sent at it. */
+static uint16_t fht_cmdq_eta(grp_indx_t group)
+{
+  uint8_t slot = g_grp_hc2[group] & 7;
+  uint8_t cmd = g_grp_cmd[group];
+  uint8_t n = fht_cmdq_count(group);
+  uint16_t due = g_due[group], slot_tick;
+
+  switch (g_event[group] & ~FHT_EV_LINKED) {
+    case FHT_EV_TEMP:
+      slot_tick = due + 4;
+      break;
+    case FHT_EV_FREEZE:
+      slot_tick = due + 2;
+      break;
+    case FHT_EV_CMD:
+      if ((cmd & 0xf) == FHT_SYNC) {
+        /* SYNC_SET goes in the first timeslot after the countdown */
+        slot_tick = due + g_slot_count[group] - 3 + 8 + slot;
+        break;
+      }
+      if ((cmd & 0xf) == FHT_PAIR) {
+        /* PAIR goes at once, SYNC_SET a period later and the queue after it */
+        return n ? due + (n + 1) * (PERIOD_BASE + slot) : due;
+      }
+      /* Normal operation restarts, see fht_tick_grp() */
+      slot_tick = due + PERIOD_BASE + slot - g_slot_count[group] - 1;
+      if ((int16_t)(slot_tick - due) <= 0)
+        slot_tick = due;
+      break;
+    default:
+      slot_tick = due;
+  }
+  /* A sent current command gives way to the first pending one at once */
+  if ((cmd & FHT_REPEAT) && n)
+    n--;
+  return slot_tick + n * (PERIOD_BASE + slot);
+}
 
-      // FHEM FHT_HB.classdef code to catch and parse last transmitted state:
-      // reading pos_tx  match       "^LOG FHT \d RFM_TX CMD='VALVE_SET (\d+)' .* grp='%group_idx'.*$"
-      // reading pos_tx  postproc { s/^LOG FHT \d RFM_TX CMD='VALVE_SET (\d+)' .* grp='%group_idx'.*$/$1/;; floor($_/255*100) }
+/* The later of two ticks */
+static uint16_t fht_tick_max(uint16_t a, uint16_t b)
+{
+  return (int16_t)(b - a) > 0 ? b : a;
+}
 
-      // reset timeslot counter
-      g_slot_count[group] = 0;
+uint16_t fht_get_ticks(void)
+{
+  uint8_t sreg = SREG;
+  uint16_t t;
 
-      // transmit message
-      fht_transmit(group);
+  cli();
+  t = g_ticks;
+  SREG = sreg;
+  return t;
+}
 
-      /* Set the repeat flag for next time */
-      (g_message[group]).command |= FHT_REPEAT;
-    }
-  }
+/* Enqueue the command of the group, returns the fht_cmdq_put() result
+   (interrupts must be disabled) */
+static uint8_t fht_enqueue_grp(grp_indx_t group, uint8_t address, uint8_t command, uint8_t value)
+{
+  uint8_t r = fht_cmdq_put(group, address, command, value);
+
+  if (r == FHT_CMDQ_CURRENT && (command == FHT_SYNC || command == FHT_PAIR))
+    fht_wheel_insert(group, g_ticks, FHT_EV_CMD);
+  return r;
 }
 
-void fht_enqueue(grp_indx_t group, uint8_t address, uint8_t command, uint8_t value)
+uint16_t fht_enqueue(grp_indx_t group, uint8_t address, uint8_t command, uint8_t value)
 {
+  uint8_t sreg = SREG;
+  uint16_t eta;
+
   LED_GREEN_ON();
+  command &= 0xf;
   if (group == grp_indx_all) {
-    //  all groups
+    //  all groups, logged in one record (the tick interrupt panics so)
     grp_indx_t g;
-    for (g = 0; g < g_groups_num; g++)
-      fht_enqueue(g, address, command, value);
+
+    cli();
+    eta = g_ticks;
+    for (g = 0; g < g_groups_num; g++) {
+      if (fht_enqueue_grp(g, address, command, value) == FHT_CMDQ_DROPPED)
+        g_log_all_dropped[g >> 3] |= 1 << (g & 7);
+      eta = fht_tick_max(eta, fht_cmdq_eta(g));
+    }
+    SREG = sreg;
+    evlog_put(FHT_LOG_RFM_TQ, FHT_LOG_ALL, g_ticks, ((FHT_EXT_PRESENT | command) << 8) | value, address << 8);
   }
   else {
     // single group
+    uint8_t r, pending;
+
     cli();
-    (g_message[group]).address = address;
-    (g_message[group]).command = FHT_EXT_PRESENT | (command & 0xf);
-    (g_message[group]).extension = value;
-    sei();
-    LOG_FHT("0 RFM_TQ ");
-    msg_enq_print(group, 0);
-    PRINTF("\n");
+    r = fht_enqueue_grp(group, address, command, value);
+    pending = fht_cmdq_count(group);
+    eta = fht_cmdq_eta(group);
+    SREG = sreg;
+
+    /* Log the command as enqueued, with the number of commands waiting
+       behind the current one (called from the tick interrupt, too) */
+    evlog_put(r == FHT_CMDQ_DROPPED ? FHT_LOG_RFM_TQ_DROP : FHT_LOG_RFM_TQ, group, g_ticks,
+              ((FHT_EXT_PRESENT | command) << 8) | value, (address << 8) | pending);
   }
+  return eta;
 }
 
-void fht_set_hc_grp(grp_indx_t group, uint8_t hc1, uint8_t hc2)
+/* Set the valve positions of groups 0 .. n-1 in one go (fht setall), the
+   commands are enqueued atomically and logged in a single line, with the
+   names of the groups whose command was dropped */
+uint16_t fht_set_all(const uint8_t *values, uint8_t n)
 {
-  fht_set_hc_msg(&(g_message[group]), hc1, hc2);
+  uint8_t t[sizeof(tlm_fht_setall_t) + FHT_GROUPS_DIM + (FHT_GROUPS_DIM + 7) / 8];
+  uint8_t *dropped = t + sizeof(tlm_fht_setall_t) + n;   // bitmap, after the positions
+  uint8_t sreg = SREG;
+  uint16_t tick, eta;
+  grp_indx_t g;
+
+  memset(dropped, 0, (n + 7) / 8);
+  LED_GREEN_ON();
+  cli();
+  tick = eta = g_ticks;
+  for (g = 0; g < n; g++) {
+    if (fht_cmdq_put(g, 0, FHT_VALVE_SET, values[g]) == FHT_CMDQ_DROPPED)
+      dropped[g >> 3] |= 1 << (g & 7);
+    eta = fht_tick_max(eta, fht_cmdq_eta(g));
+  }
+  SREG = sreg;
+
+  if (tlm_is_enabled()) {
+    tlm_fht_setall_t *h = (tlm_fht_setall_t *)t;
+
+    h->tick = tick;
+    h->groups = n;
+    memcpy(t + sizeof(tlm_fht_setall_t), values, n);
+    tlm_send(TLM_FHT_SETALL, t, sizeof(tlm_fht_setall_t) + n + (n + 7) / 8);
+  } else if (LOG_ENABLED(0)) {
+    uint8_t first = 1;
+
+    LOG_FHT(0, "RFM_TQ_ALL CMD='VALVE_SET' pos='");
+    for (g = 0; g < n; g++)
+      PRINTF(g ? " %u" : "%u", values[g]);
+    PRINTF("' tick='%u' dropped='", tick);
+    for (g = 0; g < n; g++)
+      if (dropped[g >> 3] & (1 << (g & 7))) {
+        PRINTF(first ? "%u" : " %u", grp_indx2name(g));
+        first = 0;
+      }
+    PRINTF("'\n");
+  }
+  return eta;
 }
 
-void fht_set_hc_msg(fht_msg_t *msg, uint8_t hc1, uint8_t hc2)
+void fht_set_hc_grp(grp_indx_t group, uint8_t hc1, uint8_t hc2)
 {
   cli();
-  msg->hc1 = hc1;
-  msg->hc2 = hc2;
+  g_grp_hc1[group] = hc1;
+  g_grp_hc2[group] = hc2;
   sei();
 }
 
-void fht_sync_grp(grp_indx_t group)
+/* Returns the tick of the first timeslot after the sync */
+static uint16_t fht_sync_grp(grp_indx_t group)
 {
+  uint16_t eta;
+
   cli();
-  (g_message[group]).address = 0;
-  (g_message[group]).command = FHT_EXT_PRESENT | FHT_SYNC;
-  (g_message[group]).extension = 0;
+  g_grp_addr[group] = 0;
+  g_grp_cmd[group] = FHT_EXT_PRESENT | FHT_SYNC;
+  g_grp_ext[group] = 0;
   g_slot_count[group] = SYNC_TICKS | 1;
+  g_grp_syncing[group] = 1;
+  fht_wheel_insert(group, g_ticks, FHT_EV_CMD);
+  eta = fht_cmdq_eta(group);
   sei();
+  return eta;
 }
 
-int fht_group_synced(grp_indx_t group)
+uint16_t fht_sync(grp_indx_t group)
 {
-  return ((g_message[group]).command & FHT_REPEAT);
-}
+  uint16_t eta = fht_get_ticks();
 
-
-int  fht_all_groups_synced(void)
-{
-  grp_indx_t g;
-  for (g = 0; g < g_groups_num; g++)
-    if (!fht_group_synced(g)) return 0 ;
-  return 1;
-}
-
-void fht_sync(grp_indx_t group)
-{
-  /* Enqueue the sync message.  The interrupt handler will do the rest.  We can
-   	  monitor for the command change to see when it has completed */
+  /* Start the sync and return.  The interrupt handler counts down in
+     background and logs SYNC PROGRESS, then SYNC DONE once the first real
+     command has been sent.  Commands enqueued meanwhile wait behind the sync,
+     the other groups are not affected. */
   if (group == grp_indx_all) {
     //  all groups
     grp_indx_t g;
     for (g = 0; g < g_groups_num; g++)
-      fht_sync_grp(g);
-    /* Wait for repeat bit to be set - this indicates that the first real command
-     		  has been sent following the sync procedure */
-    LOG_FHT("1 RFM_TX SYNC Waiting for ALL groups sync...\n");
-    while (!fht_all_groups_synced());
-    LOG_FHT("1 RFM_TX SYNC Sync of all groups complete\n");
+      eta = fht_tick_max(eta, fht_sync_grp(g));
+    evlog_put(FHT_LOG_SYNC_START, FHT_LOG_ALL, g_ticks, SYNC_TICKS | 1, 0);
   }
   else {
     // single group
-    fht_sync_grp(group);
-    /* Wait for repeat bit to be set - this indicates that the first real command
-     		  has been sent following the sync procedure */
-    LOG_FHT("1 RFM_TX SYNC Waiting for group %d sync...\n", grp_indx2name(group));
-    while (!fht_group_synced(group));
-    LOG_FHT("1 RFM_TX SYNC Sync group %d complete\n", grp_indx2name(group));
+    eta = fht_sync_grp(group);
+    evlog_put(FHT_LOG_SYNC_START, group, g_ticks, SYNC_TICKS | 1, 0);
   }
+  return eta;
 }
 
 
-void fht_receive(void)
+/*
+   Background receiver: frames are decoded in the nIRQ interrupt and
+   queued to a small ring, fht_receive() prints and drains them.
+*/
+
+#define FHT_RX_RING_DIM	4  // must be a power of 2
+
+typedef struct {
+  fht_msg_t msg;
+  int8_t rssi;
+} fht_rx_t;
+
+static fht_rx_t g_rx_ring [FHT_RX_RING_DIM];
+static volatile uint8_t g_rx_head = 0;     // written by the interrupt
+static volatile uint8_t g_rx_tail = 0;     // written by fht_receive()
+static volatile uint16_t g_rx_dropped = 0; // frames lost to a full ring
+static volatile bool_t g_rx_enabled = False;
+static fht_dec_t g_rx_dec;
+static uint8_t g_rx_bytes;                 // bytes received since sync
+
+/* Called from the nIRQ interrupt with the bytes following the sync word */
+static uint8_t fht_rx_handler(uint8_t *data, uint8_t len, int8_t rssi)
 {
-  // disabled to save flash space
-  //  fht_msg_t rxmsg;
-  //  uint8_t buf[FHT_BUFFER_SIZE];
-  //  int rssi;
-  //
-  //  /* Start receiver, no timeout.  Receive up to 46 bytes, which is
-  //   	 * sufficient to capture the longest (all 1s) encoded packet
-  //   	 * from the sync point onwards */
-  //  si443x_receive(buf, FHT_BUFFER_SIZE, 0, &rssi);
-  //
-  //  DPRINTF("Rx rssi %d dBm\n", rssi);
-  //
-  //  /* Dump encoded message */
-  //  hexdump(buf, FHT_BUFFER_SIZE);
-  //
-  //  if (fht_rfm_decode(buf, (uint8_t*)&rxmsg, sizeof(rxmsg)) < 0) {
-  //    DPRINTF("Symbol error\n");
-  //  }
-  //
-  //  /* Dump decoded message */
-  //  hexdump((uint8_t*)&rxmsg, sizeof(rxmsg));
-  //
-  //  /* Decode contents */
-  //  msgdump(&rxmsg);
+  uint8_t n;
+  int8_t r;
+
+  if (len == 0) {
+    /* New packet */
+    fht_decode_reset(&g_rx_dec);
+    g_rx_bytes = 0;
+    return 0;
+  }
 
+  for (n = 0; n < len; n++) {
+    r = fht_decode_byte(&g_rx_dec, data[n]);
+    if (r == FHT_DEC_FRAME) {
+      uint8_t next = (g_rx_head + 1) & (FHT_RX_RING_DIM - 1);
+      if (next == g_rx_tail) {
+        g_rx_dropped++;
+      } else {
+        memcpy(&g_rx_ring[g_rx_head].msg, g_rx_dec.msg, sizeof(fht_msg_t));
+        g_rx_ring[g_rx_head].rssi = rssi;
+        g_rx_head = next;
+      }
+    }
+    if (r != FHT_DEC_NONE)
+      return 1; // done with this packet, hunt for the next sync
+  }
+
+  /* Give up once the longest possible frame has passed */
+  g_rx_bytes += len;
+  return g_rx_bytes >= FHT_FRAME_SIZE;
 }
 
+/* (Re)start the receiver if enabled, the transmitter leaves the radio in standby */
+static void fht_rx_resume(void)
+{
+  if (g_rx_enabled)
+    si443x_rx_start(fht_rx_handler);
+}
+
+void fht_rx_enable(bool_t on)
+{
+  g_rx_enabled = on;
+  if (on) {
+    fht_decode_init(&g_rx_dec);
+    fht_rx_resume();
+  } else {
+    si443x_rx_stop();
+  }
+}
+
+bool_t fht_rx_is_enabled(void)
+{
+  return g_rx_enabled;
+}
+
+/* Print and drain frames received in background */
+void fht_receive(void)
+{
+  fht_dec_t dec;
+
+  while (g_rx_tail != g_rx_head) {
+    fht_rx_t *rx = &g_rx_ring[g_rx_tail];
+    if (tlm_is_enabled()) {
+      tlm_fht_rx_t t;
+
+      t.hc1 = rx->msg.hc1;
+      t.hc2 = rx->msg.hc2;
+      t.address = rx->msg.address;
+      t.command = rx->msg.command;
+      t.extension = rx->msg.extension;
+      t.rssi = rx->rssi;
+      tlm_send(TLM_FHT_RX, &t, sizeof(t));
+    } else {
+      MSG("FHT RX CMD='"); cmddump(&rx->msg); PRINTF("' ");
+      PRINTF("FLG='"); cmdflagsdump(&rx->msg); PRINTF("' ");
+      PRINTF("hc='%u %u' adr='%u' rssi='%d'\n", rx->msg.hc1, rx->msg.hc2, rx->msg.address, rx->rssi);
+    }
+    g_rx_tail = (g_rx_tail + 1) & (FHT_RX_RING_DIM - 1);
+  }
+
+  cli();
+  dec = g_rx_dec;
+  sei();
+  LOG_FHT(1, "RFM_RX enabled='%u' frames='%u' dropped='%u' sym_err='%u' par_err='%u' csum_err='%u'\n",
+          g_rx_enabled, dec.frames, g_rx_dropped, dec.symbol_errors, dec.parity_errors, dec.checksum_errors);
+}
 
 
 void fht_test(void)
 {
   //  fht_msg_t msg;
+  //  fht_dec_t dec;
   //  uint8_t *_msg = (uint8_t*)&msg, *ptr;
   //  uint8_t buf[FHT_BUFFER_SIZE];
   //  int n, length;
@@ -708,7 +1614,9 @@ void fht_test(void)
   //  ptr = &buf[8]; /* Skip preamble and 'sync' */
   //  length -= 8;
   //  hexdump(ptr, length);
-  //  fht_rfm_decode(ptr, (uint8_t*)&msg, sizeof(msg));
+  //  fht_decode_init(&dec);
+  //  while (length-- && fht_decode_byte(&dec, *ptr++) == FHT_DEC_NONE);
+  //  memcpy(&msg, dec.msg, sizeof(msg));
   //  hexdump((uint8_t*)&msg, sizeof(msg));
   //  msgdump(&msg);
 }
@@ -89,7 +89,9 @@ typedef  uint8_t grp_name_t;
 #define grp_name2indx(grp_name) (grp_name - 1)
 
 
-#define FHT_GROUPS_DIM                      8  // maximum number of groups = dimension of groups array (so the maximal group index is FHT_GROUPS_DIM-1)
+#ifndef FHT_GROUPS_DIM
+#define FHT_GROUPS_DIM                      8  // maximum number of groups = dimension of groups array (so the maximal group index is FHT_GROUPS_DIM-1), at most 127
+#endif
 static volatile grp_indx_t g_groups_num  = 1;  // currently used number of groups (initial 1 is overwiten by fht groups or value loaded from eeprom)
 
 void fht_init(void);
@@ -103,11 +105,21 @@ void fht_clear_panic_count(void);
 void fht_cancel_panic(void);
 bool_t fht_is_panic(void);
 void fht_tick(void);
+void fht_tick_missed(uint8_t n);
+void fht_tick_overrun(void);
+void fht_print_stats(void);
+void fht_tx_task(void);
+void fht_log_task(void);
 void fht_tick_grp(grp_indx_t group);
-void fht_enqueue(grp_indx_t group, uint8_t address, uint8_t command, uint8_t value);
-void fht_sync(grp_indx_t group);
+uint16_t fht_get_ticks(void);
+/* The enqueueing functions return the tick of the timeslot expected to send
+   the command (the latest one for all groups) */
+uint16_t fht_enqueue(grp_indx_t group, uint8_t address, uint8_t command, uint8_t value);
+uint16_t fht_set_all(const uint8_t *values, uint8_t n);
+uint16_t fht_sync(grp_indx_t group);
 void fht_set_hc_grp(grp_indx_t group, uint8_t hc1, uint8_t hc2);
-void fht_set_hc_msg(fht_msg_t *msg, uint8_t hc1, uint8_t hc2);
+void fht_rx_enable(bool_t on);
+bool_t fht_rx_is_enabled(void);
 void fht_receive(void);
 
 #endif /* FHT_H_ */
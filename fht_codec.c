@@ -0,0 +1,305 @@
+/*
+* Copyright 2013 Hynek Baran
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/*
+* Table-driven FHT bitstream encoder.
+*
+* This replaces the original bit-by-bit pushbit() encoder by Mike Stirling,
+* the output is byte-identical.
+*
+* Streaming decoder with parity and checksum verification.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#else
+#define PROGMEM
+#define pgm_read_byte(a)	(*(const uint8_t *)(a))
+#define pgm_read_dword(a)	(*(const uint32_t *)(a))
+#define memcpy_P			memcpy
+#endif
+
+#include "fht_codec.h"
+
+/*
+   Encoded form of every data nibble (MSB first) - 0 is 1100, 1 is 111000.
+   A nibble takes 16 to 24 RFM bits.
+*/
+typedef struct {
+  uint32_t pattern;
+  uint8_t len;
+} fht_nibble_sym_t;
+
+static const fht_nibble_sym_t fht_nibble_sym[16] PROGMEM = {
+  { 0x00ccccUL, 16 }, /* 0 */
+  { 0x033338UL, 18 }, /* 1 */
+  { 0x03338cUL, 18 }, /* 2 */
+  { 0x0cce38UL, 20 }, /* 3 */
+  { 0x0338ccUL, 18 }, /* 4 */
+  { 0x0ce338UL, 20 }, /* 5 */
+  { 0x0ce38cUL, 20 }, /* 6 */
+  { 0x338e38UL, 22 }, /* 7 */
+  { 0x038cccUL, 18 }, /* 8 */
+  { 0x0e3338UL, 20 }, /* 9 */
+  { 0x0e338cUL, 20 }, /* a */
+  { 0x38ce38UL, 22 }, /* b */
+  { 0x0e38ccUL, 20 }, /* c */
+  { 0x38e338UL, 22 }, /* d */
+  { 0x38e38cUL, 22 }, /* e */
+  { 0xe38e38UL, 24 }, /* f */
+};
+
+/* Parity of a nibble n is bit n of this constant */
+#define NIBBLE_PARITY		0x6996
+
+/*
+   Append len (up to 24) RFM bits to the output, whole bytes
+   are written out as soon as they are complete.
+*/
+void fht_enc_put(fht_enc_t *enc, uint32_t pattern, uint8_t len)
+{
+  enc->acc = (enc->acc << len) | pattern;
+  enc->nbits += len;
+  while (enc->nbits >= 8) {
+    enc->nbits -= 8;
+    *enc->out = enc->acc >> enc->nbits;
+    if (enc->sink)
+      enc->sink(*enc->out);
+    enc->out++;
+  }
+}
+
+/* Encode one payload byte followed by its parity bit */
+void fht_enc_byte(fht_enc_t *enc, uint8_t byte)
+{
+  const fht_nibble_sym_t *hi = &fht_nibble_sym[byte >> 4];
+  const fht_nibble_sym_t *lo = &fht_nibble_sym[byte & 0xf];
+
+  fht_enc_put(enc, pgm_read_dword(&hi->pattern), pgm_read_byte(&hi->len));
+  fht_enc_put(enc, pgm_read_dword(&lo->pattern), pgm_read_byte(&lo->len));
+  if (((NIBBLE_PARITY >> (byte >> 4)) ^ (NIBBLE_PARITY >> (byte & 0xf))) & 1)
+    fht_enc_put(enc, FHT_SYM1, FHT_SYM1_BITS);
+  else
+    fht_enc_put(enc, FHT_SYM0, FHT_SYM0_BITS);
+}
+
+/*
+   Constant frame prefix: the extra RFM preamble (4x 0xaa), 12 zeros and the
+   start bit. The zeros fill whole bytes, so the prefix is a fixed table plus
+   the start bit left pending in the encoder.
+   (avr-gcc shipped with the Arduino IDE has neither constexpr nor
+   _Static_assert, the prefix is derived by the preprocessor and checked
+   by the negative array size trick.)
+*/
+#define FHT_PREAMBLE_AA_BYTES	4
+#define FHT_SYNC_ZEROS			12
+#define FHT_SYM00				((FHT_SYM0 << FHT_SYM0_BITS) | FHT_SYM0)
+#define FHT_PREFIX_LEN			(FHT_PREAMBLE_AA_BYTES + FHT_SYNC_ZEROS * FHT_SYM0_BITS / 8)
+#define FHT_PREFIX_NBITS		(FHT_SYNC_ZEROS * FHT_SYM0_BITS % 8 + FHT_SYM1_BITS)
+
+#define FHT_STATIC_ASSERT(name, cond)	typedef char fht_static_assert_##name[(cond) ? 1 : -1]
+
+static const uint8_t fht_prefix[] PROGMEM = {
+  0xaa, 0xaa, 0xaa, 0xaa,
+  FHT_SYM00, FHT_SYM00, FHT_SYM00, FHT_SYM00, FHT_SYM00, FHT_SYM00
+};
+
+/* Two zero symbols make one whole byte 11001100 */
+FHT_STATIC_ASSERT(sym00, FHT_SYM00 == 0xcc && 2 * FHT_SYM0_BITS == 8);
+/* The zeros end on a byte boundary and the start bit stays pending */
+FHT_STATIC_ASSERT(zeros_aligned, FHT_SYNC_ZEROS * FHT_SYM0_BITS % 8 == 0);
+FHT_STATIC_ASSERT(start_pending, FHT_PREFIX_NBITS == FHT_SYM1_BITS && FHT_PREFIX_NBITS < 8);
+/* The table holds the preamble and all the zeros */
+FHT_STATIC_ASSERT(prefix_len, sizeof(fht_prefix) == FHT_PREFIX_LEN && FHT_PREFIX_LEN == 10);
+
+/* Start a frame: copy the constant prefix, the start bit is left pending */
+void fht_rfm_encode_start(fht_enc_t *enc, uint8_t *outbuf, fht_sink_t sink)
+{
+  uint8_t n;
+
+  memcpy_P(outbuf, fht_prefix, FHT_PREFIX_LEN);
+  if (sink)
+    for (n = 0; n < FHT_PREFIX_LEN; n++)
+      sink(outbuf[n]);
+  enc->out = outbuf + FHT_PREFIX_LEN;
+  enc->sink = sink;
+  enc->acc = FHT_SYM1;
+  enc->nbits = FHT_PREFIX_NBITS;
+}
+
+/* Terminate a frame started at outbuf, returns its length */
+int fht_rfm_encode_finish(fht_enc_t *enc, uint8_t *outbuf)
+{
+  /* Two trailing zeros */
+  fht_enc_put(enc, FHT_SYM00, 2 * FHT_SYM0_BITS);
+
+  /* The partially filled last byte is sent as zero (the pending
+     bits of the trailer are dropped, as the original encoder did) */
+  *enc->out++ = 0;
+  if (enc->sink)
+    enc->sink(0);
+
+  return enc->out - outbuf;
+}
+
+int fht_rfm_encode(const uint8_t *inbuf, uint8_t *outbuf, int insize)
+{
+  fht_enc_t enc;
+  int n;
+
+  fht_rfm_encode_start(&enc, outbuf, NULL);
+  for (n = 0; n < insize; n++)
+    fht_enc_byte(&enc, inbuf[n]);
+  return fht_rfm_encode_finish(&enc, outbuf);
+}
+
+uint8_t fht_rfm_encoded_len(const uint8_t *inbuf, int insize)
+{
+  uint16_t nbits = FHT_PREFIX_LEN * 8 + FHT_PREFIX_NBITS + 2 * FHT_SYM0_BITS;
+  uint8_t byte;
+  int n;
+
+  /* A zero takes 4 RFM bits, a one 6, the parity bit keeps the number
+     of ones in each byte even */
+  for (n = 0; n < insize; n++) {
+    byte = inbuf[n];
+    byte = (byte & 0x55) + ((byte >> 1) & 0x55);
+    byte = (byte & 0x33) + ((byte >> 2) & 0x33);
+    byte = (byte & 0x0f) + (byte >> 4);
+    nbits += 9 * FHT_SYM0_BITS + ((byte + 1) & ~1) * (FHT_SYM1_BITS - FHT_SYM0_BITS);
+  }
+
+  /* Whole bytes plus the trailing zero byte */
+  return nbits / 8 + 1;
+}
+
+/*
+   Decoder
+*/
+
+void fht_decode_init(fht_dec_t *dec)
+{
+  memset(dec, 0, sizeof(fht_dec_t));
+}
+
+void fht_decode_reset(fht_dec_t *dec)
+{
+  dec->window = 0;
+  dec->avail = 0;
+  dec->in_frame = 0;
+  dec->sync = 0;
+}
+
+/* Abort the current frame and hunt for the next start bit */
+static int8_t fht_dec_abort(fht_dec_t *dec, uint16_t *counter)
+{
+  int8_t r = FHT_DEC_NONE;
+
+  if (dec->in_frame) {
+    (*counter)++;
+    r = FHT_DEC_ERROR;
+  }
+  dec->in_frame = 0;
+  dec->sync = 0;
+  return r;
+}
+
+/* Take one protocol bit */
+static int8_t fht_dec_bit(fht_dec_t *dec, uint8_t bit)
+{
+  uint8_t byte, n, checksum;
+
+  if (!dec->in_frame) {
+    /* Hunt for a run of zeros terminated by the start bit */
+    if (!bit) {
+      if (dec->sync < 0xff)
+        dec->sync++;
+    } else {
+      dec->in_frame = (dec->sync >= FHT_DEC_SYNC_ZEROS);
+      dec->sync = 0;
+      dec->shift = 0;
+      dec->nbits = 0;
+      dec->nbytes = 0;
+    }
+    return FHT_DEC_NONE;
+  }
+
+  dec->shift = (dec->shift << 1) | bit;
+  if (++dec->nbits < 9)
+    return FHT_DEC_NONE;
+
+  /* 8 data bits followed by the even parity bit */
+  byte = dec->shift >> 1;
+  if (((NIBBLE_PARITY >> (byte >> 4)) ^ (NIBBLE_PARITY >> (byte & 0xf)) ^ dec->shift) & 1)
+    return fht_dec_abort(dec, &dec->parity_errors);
+  dec->msg[dec->nbytes++] = byte;
+  dec->shift = 0;
+  dec->nbits = 0;
+  if (dec->nbytes < FHT_MSG_SIZE)
+    return FHT_DEC_NONE;
+
+  checksum = 0x0c;
+  for (n = 0; n < FHT_MSG_SIZE - 1; n++)
+    checksum += dec->msg[n];
+  if (checksum != dec->msg[FHT_MSG_SIZE - 1])
+    return fht_dec_abort(dec, &dec->checksum_errors);
+
+  dec->in_frame = 0;
+  dec->sync = 0;
+  dec->frames++;
+  return FHT_DEC_FRAME;
+}
+
+int8_t fht_decode_byte(fht_dec_t *dec, uint8_t in)
+{
+  int8_t r = FHT_DEC_NONE, rb;
+  uint8_t sym;
+
+  dec->window = (dec->window << 8) | in;
+  dec->avail += 8;
+
+  while (dec->avail >= FHT_SYM0_BITS) {
+    /* Next undecoded 8 bits, left-justified */
+    if (dec->avail >= 8)
+      sym = dec->window >> (dec->avail - 8);
+    else
+      sym = dec->window << (8 - dec->avail);
+
+    if ((sym & 0xf0) == 0xc0) {
+      /* 1100 - zero bit */
+      rb = fht_dec_bit(dec, 0);
+      dec->avail -= FHT_SYM0_BITS;
+    } else if ((sym & 0xe0) == 0xe0 && dec->avail < FHT_SYM1_BITS) {
+      /* May be a one bit, wait for more input */
+      break;
+    } else if ((sym & 0xfc) == 0xe0) {
+      /* 111000 - one bit */
+      rb = fht_dec_bit(dec, 1);
+      dec->avail -= FHT_SYM1_BITS;
+    } else {
+      /* Invalid pattern (or idle line) - skip one bit */
+      rb = fht_dec_abort(dec, &dec->symbol_errors);
+      dec->avail--;
+    }
+    if (rb != FHT_DEC_NONE && r != FHT_DEC_FRAME)
+      r = rb;
+  }
+  return r;
+}
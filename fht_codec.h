@@ -0,0 +1,126 @@
+/*
+* Copyright 2013 Hynek Baran
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/*
+* FHT pulse-width line coding for the RFM22/23 OOK transmitter.
+*
+* A protocol bit 0 is sent as 1100 and a 1 as 111000 (200 us per RFM bit),
+* each payload byte is followed by its parity bit.
+* The code has no AVR dependencies besides PROGMEM so it may be compiled
+* on a host, too.
+*/
+
+#ifndef FHT_CODEC_H_
+#define FHT_CODEC_H_
+
+#include <stdint.h>
+
+/*! Encoded symbols (right-justified) and their lengths in RFM bits */
+#define FHT_SYM0			0x0c
+#define FHT_SYM0_BITS		4
+#define FHT_SYM1			0x38
+#define FHT_SYM1_BITS		6
+
+/*! Encoder byte sink, e.g. an open radio FIFO burst */
+typedef void (*fht_sink_t)(uint8_t byte);
+
+/*! Encoder state: whole bytes go to out (and to sink if set),
+    pending bits are kept in acc */
+typedef struct {
+  uint8_t *out;
+  fht_sink_t sink;
+  uint32_t acc;
+  uint8_t nbits;
+} fht_enc_t;
+
+#ifdef __cplusplus /* If this is a C++ compiler, use C linkage */
+extern "C" {
+#endif
+
+void fht_enc_put(fht_enc_t *enc, uint32_t pattern, uint8_t len);
+void fht_enc_byte(fht_enc_t *enc, uint8_t byte);
+
+/*!
+   Frame encoding in steps: fht_rfm_encode_start() writes the preamble,
+   payload bytes are added by fht_enc_byte() and fht_rfm_encode_finish()
+   adds the trailer and returns the frame length.
+   The encoder state may be saved between the steps to re-encode only
+   the tail of a frame.
+   The sink is set by fht_rfm_encode_start() and receives every byte
+   written to outbuf (NULL for none).
+*/
+void fht_rfm_encode_start(fht_enc_t *enc, uint8_t *outbuf, fht_sink_t sink);
+int fht_rfm_encode_finish(fht_enc_t *enc, uint8_t *outbuf);
+
+/*!
+   Encode a buffer into a format that will generate
+   the FHT pulse-width encoding when transmitted.
+   Parity bit is added for each byte.
+   Returns the number of bytes written to outbuf.
+*/
+int fht_rfm_encode(const uint8_t *inbuf, uint8_t *outbuf, int insize);
+
+/*! Number of bytes fht_rfm_encode() would write, without encoding */
+uint8_t fht_rfm_encoded_len(const uint8_t *inbuf, int insize);
+
+/*! Size of the decoded message: hc1, hc2, address, command, extension, checksum */
+#define FHT_MSG_SIZE		6
+
+/*! Minimum number of preamble zeros before the start bit.  The radio sync
+    word (4x 0xcc) consumes 8 of the 12 zeros, at least 2 of the rest are
+    required to accept a start bit. */
+#define FHT_DEC_SYNC_ZEROS	2
+
+/*! Streaming decoder state.  Encoded bytes may be fed in arbitrary chunks,
+    the decoder resumes where the previous chunk ended. */
+typedef struct {
+  uint16_t window;              /* undecoded RFM bits (right-justified) */
+  uint8_t avail;                /* number of undecoded bits in window */
+  uint8_t in_frame;             /* start bit seen, collecting payload */
+  uint8_t sync;                 /* zero protocol bits seen while hunting */
+  uint16_t shift;               /* payload bits of the current byte (with parity) */
+  uint8_t nbits;                /* number of bits in shift */
+  uint8_t nbytes;               /* number of payload bytes in msg */
+  uint8_t msg[FHT_MSG_SIZE];    /* decoded message */
+  /* statistics */
+  uint16_t frames;              /* frames decoded */
+  uint16_t symbol_errors;       /* invalid pulse pattern inside a frame */
+  uint16_t parity_errors;       /* bad parity bit */
+  uint16_t checksum_errors;     /* bad message checksum */
+} fht_dec_t;
+
+/*! fht_decode_byte() results */
+#define FHT_DEC_NONE		0	/* need more input */
+#define FHT_DEC_FRAME		1	/* complete message in dec->msg */
+#define FHT_DEC_ERROR		-1	/* frame aborted (symbol, parity or checksum error) */
+
+void fht_decode_init(fht_dec_t *dec);
+
+/*! Drop undecoded input and hunt for a new frame, statistics are kept */
+void fht_decode_reset(fht_dec_t *dec);
+
+/*!
+   Feed one encoded byte (MSB first) to the decoder.
+   At most one frame may complete within a byte, the bits following it
+   are already processed by the hunt for the next frame.
+*/
+int8_t fht_decode_byte(fht_dec_t *dec, uint8_t in);
+
+#ifdef __cplusplus /* If this is a C++ compiler, use C linkage */
+}
+#endif
+
+#endif /* FHT_CODEC_H_ */
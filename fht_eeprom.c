@@ -86,12 +86,12 @@ void fht_eeprom_save_header(grp_indx_t group_num)
 }
 
 /* save single group to eeprom */
-void fht_eeprom_save_group(grp_indx_t group, fht_msg_t *msg) 
+void fht_eeprom_save_group(grp_indx_t group, uint8_t hc1, uint8_t hc2) 
 {
   fht_eeprom_group_t grp_cfg;
   
-  grp_cfg.hc1 = msg->hc1;  
-  grp_cfg.hc2 = msg->hc2;
+  grp_cfg.hc1 = hc1;  
+  grp_cfg.hc2 = hc2;
                       
   // write our only group data to eeprom (a sequence of all groups will be here once multiple groups implemented) 
   // TODO: use eeprom_update_block
@@ -101,7 +101,7 @@ void fht_eeprom_save_group(grp_indx_t group, fht_msg_t *msg)
 }
 
 /* load the whole config (header & all groups) from eeprom */
-signed int fht_eeprom_load(fht_msg_t msgs[]) // returns number of groups or negative error code
+signed int fht_eeprom_load(void) // returns number of groups or negative error code
 {
   fht_eeprom_header_t header_cfg;
   fht_eeprom_group_t  grp_cfg;
@@ -114,13 +114,16 @@ signed int fht_eeprom_load(fht_msg_t msgs[]) // returns number of groups or nega
   if ((header_cfg.version != 1 ) || (header_cfg.header_size != g_fht_eeprom_header.header_size)  ||  (header_cfg.group_size != g_fht_eeprom_header.group_size)) 
     return -2; // error, version or header/group data size does not match current implementation
 
+  if (header_cfg.groups < 0 || header_cfg.groups > FHT_GROUPS_DIM)
+    return -3; // error, more groups than this build supports (FHT_GROUPS_DIM)
+
   for (g = 0; g < header_cfg.groups; g++)
   {
     eeprom_read_block((void*) &grp_cfg,              
                       (void*) header_cfg.header_size + g*header_cfg.group_size, 
                       header_cfg.group_size);
   
-    fht_set_hc_msg(&(msgs[g]), grp_cfg.hc1, grp_cfg.hc2);
+    fht_set_hc_grp(g, grp_cfg.hc1, grp_cfg.hc2);
   }
   
   return header_cfg.groups;
@@ -140,7 +143,7 @@ void fht_eeprom_print(void) {
                     g_fht_eeprom_header.header_size); 
                     
   if ((header_cfg.version != 1 ) || (header_cfg.header_size != g_fht_eeprom_header.header_size)  ||  (header_cfg.group_size != g_fht_eeprom_header.group_size)) 
-    LOG_FHT("1 EEPROM Header mismatch!\n");
+    LOG_FHT(1, "EEPROM Header mismatch!\n");
     
   
   
@@ -156,7 +159,7 @@ void fht_eeprom_print(void) {
                       (void*) header_cfg.header_size + g*header_cfg.group_size, 
                       header_cfg.group_size);
     
-    LOG_FHT("1 EEPROM Group='%u' hc='%u %u'='0x%X 0x%X'\n", grp_indx2name(g), grp_cfg.hc1, grp_cfg.hc2,  grp_cfg.hc1, grp_cfg.hc2);
+    LOG_FHT(1, "EEPROM Group='%u' hc='%u %u'='0x%X 0x%X'\n", grp_indx2name(g), grp_cfg.hc1, grp_cfg.hc2,  grp_cfg.hc1, grp_cfg.hc2);
   }
   
   return header_cfg.groups;
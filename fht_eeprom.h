@@ -18,8 +18,8 @@
 #define FHT_eeprom_H_
 
 void fht_eeprom_save_header(grp_indx_t group_num);
-void fht_eeprom_save_group(grp_indx_t group, fht_msg_t* msg);
-grp_indx_t  fht_eeprom_load(fht_msg_t msgs[]);
+void fht_eeprom_save_group(grp_indx_t group, uint8_t hc1, uint8_t hc2);
+grp_indx_t  fht_eeprom_load(void);
 void fht_eeprom_print(void);
 
 
@@ -0,0 +1,65 @@
+/*
+* Copyright 2013 Hynek Baran
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#else
+#define PROGMEM
+#define pgm_read_byte(a)	(*(const uint8_t *)(a))
+#define strcmp_P			strcmp
+#endif
+
+#include "fht_sub.h"
+
+/* Sorted by name for the binary search */
+const fht_sub_t fht_subs[FHT_SUB_UNKNOWN] PROGMEM = {
+  { "beep",   FHT_SUB_BEEP },
+  { "groups", FHT_SUB_GROUPS },
+  { "hc",     FHT_SUB_HC },
+  { "hcd",    FHT_SUB_HCD },
+  { "hch",    FHT_SUB_HCH },
+  { "idle",   FHT_SUB_IDLE },
+  { "info",   FHT_SUB_INFO },
+  { "offset", FHT_SUB_OFFSET },
+  { "pair",   FHT_SUB_PAIR },
+  { "set",    FHT_SUB_SET },
+  { "setall", FHT_SUB_SETALL },
+  { "seth",   FHT_SUB_SETH },
+  { "setp",   FHT_SUB_SETP },
+  { "stats",  FHT_SUB_STATS },
+  { "sync",   FHT_SUB_SYNC },
+};
+
+uint8_t fht_sub_find(const char *name)
+{
+  int8_t lo = 0, hi = FHT_SUB_UNKNOWN - 1, mid;
+  int r;
+
+  while (lo <= hi) {
+    mid = (lo + hi) / 2;
+    r = strcmp_P(name, fht_subs[mid].name);
+    if (r == 0)
+      return pgm_read_byte(&fht_subs[mid].sub);
+    if (r < 0)
+      hi = mid - 1;
+    else
+      lo = mid + 1;
+  }
+  return FHT_SUB_UNKNOWN;
+}
@@ -0,0 +1,69 @@
+/*
+* Copyright 2013 Hynek Baran
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/*
+* Subcommands of the "fht" CLI command, looked up by binary search of a
+* table sorted by name.
+* The code has no AVR dependencies besides PROGMEM so it may be compiled
+* on a host, too.
+*/
+
+#ifndef FHT_SUB_H_
+#define FHT_SUB_H_
+
+#include <stdint.h>
+
+/* If this is a C++ compiler, use C linkage */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! Subcommands, in name order like fht_subs[] */
+enum {
+  FHT_SUB_BEEP,
+  FHT_SUB_GROUPS,
+  FHT_SUB_HC,
+  FHT_SUB_HCD,
+  FHT_SUB_HCH,
+  FHT_SUB_IDLE,
+  FHT_SUB_INFO,
+  FHT_SUB_OFFSET,
+  FHT_SUB_PAIR,
+  FHT_SUB_SET,
+  FHT_SUB_SETALL,
+  FHT_SUB_SETH,
+  FHT_SUB_SETP,
+  FHT_SUB_STATS,
+  FHT_SUB_SYNC,
+  FHT_SUB_UNKNOWN
+};
+
+typedef struct {
+  char name[7];
+  uint8_t sub;
+} fht_sub_t;
+
+/*! Subcommand table (in program memory on AVR), one entry per subcommand */
+extern const fht_sub_t fht_subs[FHT_SUB_UNKNOWN];
+
+/*! Return the subcommand of the name, FHT_SUB_UNKNOWN if there is none */
+uint8_t fht_sub_find(const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FHT_SUB_H_ */
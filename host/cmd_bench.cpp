@@ -0,0 +1,159 @@
+/*
+* Copyright 2013 Hynek Baran
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/*
+* Command lookup cost: fht_sub_find() (../fht_sub.c) and the CLI command
+* lookup (../cli.c), built from the firmware sources, against the linear
+* strcmp scans they replaced, which are kept below as the baseline.
+* The fht_subs[] table is first checked to be sorted and every name in
+* both tables to be found.
+*
+*   ./cmd_bench [<lookups>]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../fht_sub.h"
+#include "../cli.h"
+
+#define DIM(a) ((int)(sizeof(a) / sizeof((a)[0])))
+
+/* Baseline: the order of the strcmp_PF() chain in the old fht_handler()
+   (newer subcommands, like setall, scan the whole chain and miss) */
+static const char *const fht_chain[] = {
+  "hc", "hcd", "hch", "pair", "sync", "set", "seth", "setp", "offset",
+  "groups", "beep", "info", "stats", "idle",
+};
+
+/* The commands main.c registers, in registration order ("help" is
+   registered by cli_init()).  The old cli_task() scanned them so. */
+static const char *const cli_chain[] = {
+  "help", "fht", "fhtrx", "tlm", "log", "tmp", "mem",
+};
+
+typedef int (*find_t)(const char *name);
+
+static int fht_linear(const char *name)
+{
+  for (int i = 0; i < DIM(fht_chain); i++)
+    if (!strcmp(name, fht_chain[i]))
+      return i;
+  return -1;
+}
+
+static int fht_binary(const char *name)
+{
+  return fht_sub_find(name);
+}
+
+static int cli_linear(const char *name)
+{
+  for (int i = 0; i < DIM(cli_chain); i++)
+    if (!strcmp(name, cli_chain[i]))
+      return i;
+  return -1;
+}
+
+static int cli_binary(const char *name)
+{
+  return cli_find_command(name) != NULL;
+}
+
+static int cli_dummy(cli_t *ctx, void *arg, int argc, char **argv)
+{
+  return 0;
+}
+
+/* Look the names up over and over, returns ns per lookup */
+static double run(find_t find, char (*names)[8], int nnames, long lookups, unsigned long *sum)
+{
+  clock_t t0 = clock();
+
+  for (long i = 0; i < lookups; i++)
+    *sum += find(names[i % nnames]);    /* keep the work */
+  return (double)(clock() - t0) / CLOCKS_PER_SEC * 1e9 / lookups;
+}
+
+static void report(const char *what, int n, double old_ns, double new_ns, unsigned long sum)
+{
+  printf("%-4s %2d names  linear %6.1f ns  binary %6.1f ns  speedup %5.2fx (checksum %lu)\n",
+         what, n, old_ns, new_ns, old_ns / new_ns, sum & 0xff);
+}
+
+int main(int argc, char **argv)
+{
+  long lookups = argc > 1 ? atol(argv[1]) : 20000000;
+  /* Every name once and a miss, copied like the CLI edit buffer */
+  char names[FHT_SUB_UNKNOWN + 1][8];
+  unsigned long sum = 0;
+  int n, errors = 0;
+
+  if (lookups < 1) {
+    fprintf(stderr, "usage: cmd_bench [<lookups>]\n");
+    return 2;
+  }
+
+  /* fht subcommands: the real table must be sorted and complete */
+  for (n = 0; n < FHT_SUB_UNKNOWN; n++) {
+    if (n && strcmp(fht_subs[n - 1].name, fht_subs[n].name) >= 0) {
+      fprintf(stderr, "fht_subs[] not sorted at '%s'\n", fht_subs[n].name);
+      errors++;
+    }
+    if (fht_sub_find(fht_subs[n].name) != fht_subs[n].sub) {
+      fprintf(stderr, "fht_sub_find() misses '%s'\n", fht_subs[n].name);
+      errors++;
+    }
+    strcpy(names[n], fht_subs[n].name);
+  }
+  strcpy(names[n], "xyz");
+  if (fht_sub_find(names[n]) != FHT_SUB_UNKNOWN) {
+    fprintf(stderr, "fht_sub_find() finds '%s'\n", names[n]);
+    errors++;
+  }
+  if (errors)
+    return 1;
+  report("fht", FHT_SUB_UNKNOWN, run(fht_linear, names, FHT_SUB_UNKNOWN + 1, lookups, &sum),
+         run(fht_binary, names, FHT_SUB_UNKNOWN + 1, lookups, &sum), sum);
+
+  /* cli commands, registered in the order main.c does */
+  cli_init(stdin, stdout, NULL, "bench");
+  for (n = 1; n < DIM(cli_chain); n++)
+    cli_register_command(cli_chain[n], cli_dummy, NULL, "");
+  for (n = 0; n < DIM(cli_chain); n++) {
+    cli_cmd_t *cmd;
+
+    strcpy(names[n], cli_chain[n]);
+    cmd = cli_find_command(names[n]);
+    if (!cmd || strcmp(cmd->cmd, names[n])) {
+      fprintf(stderr, "cli_find_command() misses '%s'\n", names[n]);
+      errors++;
+    }
+  }
+  strcpy(names[n], "xyz");
+  if (cli_find_command(names[n])) {
+    fprintf(stderr, "cli_find_command() finds '%s'\n", names[n]);
+    errors++;
+  }
+  if (errors)
+    return 1;
+  sum = 0;
+  report("cli", DIM(cli_chain), run(cli_linear, names, DIM(cli_chain) + 1, lookups, &sum),
+         run(cli_binary, names, DIM(cli_chain) + 1, lookups, &sum), sum);
+  return 0;
+}
@@ -0,0 +1,153 @@
+/*
+* Copyright 2013 Hynek Baran
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/*
+* Throughput of the table-driven FHT encoder (../fht_codec.c) against the
+* original bit-by-bit pushbit() encoder, which is kept below as the
+* baseline.  Both are first checked to give identical frames.
+*
+*   ./codec_bench [<frames>]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../fht_codec.h"
+
+#define OUT_DIM 64
+
+/* Baseline: the encoder as it was in fht.c before the table version */
+static uint8_t g_nbits;
+
+static void pushbit(int bit, uint8_t **outptr)
+{
+  static uint8_t byteval = 0;
+  int size, shift;
+  uint8_t mask;
+
+  if (bit) {
+    // 1 is 600us on/off - load 111000 to output
+    size = 6;
+    mask = 0x38;
+  }
+  else {
+    // 0 is 400us on/off - load 1100 to output
+    size = 4;
+    mask = 0x0c;
+  }
+
+  while (size) {
+    // shift to fit
+    shift = (size > (8 - g_nbits)) ? (8 - g_nbits) : size;
+    byteval = (byteval << shift) | (mask >> (size - shift));
+    size -= shift;
+    g_nbits += shift;
+    if (g_nbits == 8) {
+      *(*outptr) = byteval;
+      (*outptr)++;
+      g_nbits = 0;
+    }
+  }
+}
+
+static int pushbit_encode(const uint8_t *inbuf, uint8_t *outbuf, int insize)
+{
+  int n, nbits;
+  uint8_t byte;
+  uint8_t *outptr = outbuf;
+
+  g_nbits = 0;
+  for (n = 0; n < 4; n++)
+    *outptr++ = 0xaa;
+  for (n = 0; n < 12; n++)
+    pushbit(0, &outptr);
+  pushbit(1, &outptr);
+  for (n = 0; n < insize; n++) {
+    int parity = 0;
+    byte = inbuf[n];
+    for (nbits = 0; nbits < 8; nbits++) {
+      pushbit(byte & 0x80, &outptr);
+      parity ^= (byte / 0x80);
+      byte <<= 1;
+    }
+    pushbit(parity, &outptr);
+  }
+  pushbit(0, &outptr);
+  pushbit(0, &outptr);
+
+  return outptr - outbuf + 1;
+}
+
+typedef int (*encode_t)(const uint8_t *inbuf, uint8_t *outbuf, int insize);
+
+static void random_msg(uint8_t *msg)
+{
+  for (int n = 0; n < FHT_MSG_SIZE; n++)
+    msg[n] = rand() & 0xff;
+}
+
+/* Encode the messages over and over, returns frames per second */
+static double run(encode_t encode, const uint8_t (*msgs)[FHT_MSG_SIZE], int nmsgs, long frames,
+                  unsigned long *sum)
+{
+  uint8_t out[OUT_DIM];
+  clock_t t0 = clock();
+
+  for (long n = 0; n < frames; n++) {
+    int len = encode(msgs[n % nmsgs], out, FHT_MSG_SIZE);
+    *sum += out[len / 2] + len;         /* keep the work */
+  }
+  return frames / ((double)(clock() - t0) / CLOCKS_PER_SEC);
+}
+
+int main(int argc, char **argv)
+{
+  enum { NMSGS = 1024 };
+  static uint8_t msgs[NMSGS][FHT_MSG_SIZE];
+  long frames = argc > 1 ? atol(argv[1]) : 2000000;
+  unsigned long sum = 0;
+  uint8_t a[OUT_DIM], b[OUT_DIM];
+  double old_fps, new_fps;
+
+  srand(1);
+  for (int n = 0; n < NMSGS; n++)
+    random_msg(msgs[n]);
+
+  /* Identical output, including the length */
+  for (long n = 0; n < 100000; n++) {
+    uint8_t msg[FHT_MSG_SIZE];
+    int la, lb;
+
+    random_msg(msg);
+    memset(a, 0, sizeof(a));
+    memset(b, 0, sizeof(b));
+    la = pushbit_encode(msg, a, FHT_MSG_SIZE);
+    lb = fht_rfm_encode(msg, b, FHT_MSG_SIZE);
+    if (la != lb || memcmp(a, b, la)) {
+      fprintf(stderr, "mismatch: pushbit len %d, table len %d\n", la, lb);
+      return 1;
+    }
+  }
+
+  old_fps = run(pushbit_encode, msgs, NMSGS, frames, &sum);
+  new_fps = run(fht_rfm_encode, msgs, NMSGS, frames, &sum);
+  printf("pushbit  %10.0f frames/s %8.1f ns/frame\n", old_fps, 1e9 / old_fps);
+  printf("table    %10.0f frames/s %8.1f ns/frame\n", new_fps, 1e9 / new_fps);
+  printf("speedup  %10.2fx (checksum %lu)\n", new_fps / old_fps, sum & 0xff);
+  return 0;
+}
@@ -0,0 +1,329 @@
+/*
+* Copyright 2013 Hynek Baran
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include <stdio.h>
+
+#include "fht_tlm.h"
+
+namespace fht_tlm {
+
+uint8_t crc8_update(uint8_t crc, uint8_t data)
+{
+  crc ^= data;
+  for (int i = 0; i < 8; i++)
+    crc = (crc & 1) ? (crc >> 1) ^ 0x8c : crc >> 1;
+  return crc;
+}
+
+Decoder::Decoder()
+  : in_frame_(false), escape_(false), stats_()
+{
+  frame_.type = 0;
+}
+
+void Decoder::reset()
+{
+  in_frame_ = false;
+  escape_ = false;
+  buf_.clear();
+  line_.clear();
+}
+
+Decoder::Result Decoder::end_frame()
+{
+  uint8_t crc = 0;
+
+  in_frame_ = false;
+  if (escape_ || buf_.size() < 2) {
+    stats_.framing_errors++;
+    return ERROR;
+  }
+  for (size_t n = 0; n < buf_.size() - 1; n++)
+    crc = crc8_update(crc, buf_[n]);
+  if (crc != buf_.back()) {
+    stats_.crc_errors++;
+    return ERROR;
+  }
+  frame_.type = buf_[0];
+  frame_.payload.assign(buf_.begin() + 1, buf_.end() - 1);
+  stats_.frames++;
+  return FRAME;
+}
+
+Decoder::Result Decoder::feed(uint8_t c)
+{
+  if (c == TLM_STX) {
+    /* A new frame aborts an unterminated one */
+    Result r = in_frame_ ? ERROR : NONE;
+
+    if (in_frame_)
+      stats_.framing_errors++;
+    in_frame_ = true;
+    escape_ = false;
+    buf_.clear();
+    return r;
+  }
+
+  if (!in_frame_) {
+    if (c == TLM_ETX || c == TLM_DLE || c == '\r')
+      return NONE;
+    if (c != '\n') {
+      line_ += (char)c;
+      return NONE;
+    }
+    text_.swap(line_);
+    line_.clear();
+    stats_.lines++;
+    return TEXT;
+  }
+
+  if (c == TLM_ETX)
+    return end_frame();
+
+  if (c == TLM_DLE) {
+    escape_ = true;
+    return NONE;
+  }
+  if (escape_) {
+    c ^= TLM_ESC_XOR;
+    escape_ = false;
+  }
+  if (buf_.size() >= MAX_FRAME) {
+    in_frame_ = false;
+    stats_.framing_errors++;
+    return ERROR;
+  }
+  buf_.push_back(c);
+  return NONE;
+}
+
+/* Little endian payload reader */
+namespace {
+
+class Reader {
+public:
+  Reader(const Frame &f, uint8_t type, size_t len)
+    : p_(f.payload), pos_(0), ok_(f.type == type && f.payload.size() == len) {}
+  bool ok() const { return ok_; }
+  uint8_t u8() { return p_[pos_++]; }
+  uint16_t u16() { uint16_t v = p_[pos_] | (p_[pos_ + 1] << 8); pos_ += 2; return v; }
+  int16_t s16() { return (int16_t)u16(); }
+
+private:
+  const std::vector<uint8_t> &p_;
+  size_t pos_;
+  bool ok_;
+};
+
+} // namespace
+
+bool decode(const Frame &f, FhtTx &out)
+{
+  Reader r(f, TLM_FHT_TX, sizeof(tlm_fht_tx_t));
+
+  if (!r.ok())
+    return false;
+  out.group = r.u8();
+  out.hc1 = r.u8();
+  out.hc2 = r.u8();
+  out.address = r.u8();
+  out.command = r.u8();
+  out.extension = r.u8();
+  out.tick = r.u16();
+  return true;
+}
+
+bool decode(const Frame &f, FhtTq &out)
+{
+  Reader r(f, TLM_FHT_TQ, sizeof(tlm_fht_tq_t));
+
+  if (!r.ok())
+    return false;
+  out.group = r.u8();
+  out.address = r.u8();
+  out.command = r.u8();
+  out.extension = r.u8();
+  out.dropped = r.u8() != 0;
+  out.pending = r.u8();
+  out.tick = r.u16();
+  return true;
+}
+
+bool decode(const Frame &f, FhtRx &out)
+{
+  Reader r(f, TLM_FHT_RX, sizeof(tlm_fht_rx_t));
+
+  if (!r.ok())
+    return false;
+  out.hc1 = r.u8();
+  out.hc2 = r.u8();
+  out.address = r.u8();
+  out.command = r.u8();
+  out.extension = r.u8();
+  out.rssi = (int8_t)r.u8();
+  return true;
+}
+
+bool decode(const Frame &f, Temp &out)
+{
+  Reader r(f, TLM_TEMP, sizeof(tlm_temp_t));
+
+  if (!r.ok())
+    return false;
+  out.dev_type = r.u8();
+  out.dev_index = r.u8();
+  out.t10 = r.s16();
+  return true;
+}
+
+bool decode(const Frame &f, Vcc &out)
+{
+  Reader r(f, TLM_VCC, sizeof(tlm_vcc_t));
+
+  if (!r.ok())
+    return false;
+  out.dev_type = r.u8();
+  out.mv = r.u16();
+  return true;
+}
+
+bool decode(const Frame &f, Freeze &out)
+{
+  Reader r(f, TLM_FREEZE, sizeof(tlm_freeze_t));
+
+  if (!r.ok())
+    return false;
+  out.event = r.u8();
+  out.group = r.u8();
+  out.t10 = r.s16();
+  out.tick = r.u16();
+  return true;
+}
+
+bool decode(const Frame &f, FhtSetAll &out)
+{
+  const size_t hdr = sizeof(tlm_fht_setall_t);
+  size_t groups;
+
+  if (f.type != TLM_FHT_SETALL || f.payload.size() < hdr)
+    return false;
+  groups = f.payload[2];
+  if (f.payload.size() != hdr + groups + (groups + 7) / 8)
+    return false;
+  out.tick = f.payload[0] | (f.payload[1] << 8);
+  out.positions.assign(f.payload.begin() + hdr, f.payload.begin() + hdr + groups);
+  out.dropped.clear();
+  for (size_t g = 0; g < groups; g++)
+    if (f.payload[hdr + groups + g / 8] & (1 << (g % 8)))
+      out.dropped.push_back(g + 1);
+  return true;
+}
+
+bool decode(const Frame &f, FhtSync &out)
+{
+  Reader r(f, TLM_FHT_SYNC, sizeof(tlm_fht_sync_t));
+
+  if (!r.ok())
+    return false;
+  out.event = r.u8();
+  out.group = r.u8();
+  out.count = r.u8();
+  out.tick = r.u16();
+  return true;
+}
+
+std::string to_string(const Frame &f)
+{
+  static const char *const devs[] = { "m328", "si443", "DS18x20" };
+  static const char *const freeze[] = { "ENTER", "LEAVE", "ENFORCE" };
+  static const char *const sync[] = { "START", "PROGRESS", "DONE" };
+  char s[512];                          /* RFM_TQ_ALL of all the groups */
+  FhtTx tx;
+  FhtTq tq;
+  FhtRx rx;
+  Temp t;
+  Vcc v;
+  Freeze fz;
+  FhtSetAll sa;
+  FhtSync sy;
+
+  if (decode(f, tx))
+    snprintf(s, sizeof(s), "RFM_TX grp='%u' hc='%u %u' adr='%u' cmd='0x%02X' ext='0x%02X' tick='%u'",
+             tx.group + 1, tx.hc1, tx.hc2, tx.address, tx.command, tx.extension, tx.tick);
+  else if (decode(f, tq))
+    snprintf(s, sizeof(s), "%s grp='%u' adr='%u' cmd='0x%02X' ext='0x%02X' pend='%u' tick='%u'",
+             tq.dropped ? "RFM_TQ_DROP" : "RFM_TQ", tq.group + 1, tq.address, tq.command, tq.extension,
+             tq.pending, tq.tick);
+  else if (decode(f, rx))
+    snprintf(s, sizeof(s), "RFM_RX hc='%u %u' adr='%u' cmd='0x%02X' ext='0x%02X' rssi='%d'",
+             rx.hc1, rx.hc2, rx.address, rx.command, rx.extension, rx.rssi);
+  else if (decode(f, t))
+    snprintf(s, sizeof(s), "TMP value='%.1f' unit='C' dev_type='%s' dev_index='%u'",
+             t.t10 / 10.0, t.dev_type < 3 ? devs[t.dev_type] : "?", t.dev_index);
+  else if (decode(f, v))
+    snprintf(s, sizeof(s), "VCC value='%u' unit='mV' dev_type='%s'",
+             v.mv, v.dev_type < 3 ? devs[v.dev_type] : "?");
+  else if (decode(f, fz))
+    snprintf(s, sizeof(s), "FREEZING %s grp='%u' lastT10='%d' tick='%u'",
+             fz.event < 3 ? freeze[fz.event] : "?", fz.group + 1, fz.t10, fz.tick);
+  else if (decode(f, sy))
+    snprintf(s, sizeof(s), "SYNC %s grp='%u' cnt='%u' tick='%u'",
+             sy.event < 3 ? sync[sy.event] : "?", sy.group + 1, sy.count, sy.tick);
+  else if (decode(f, sa)) {
+    std::string pos, dropped;
+    char num[5];
+
+    for (size_t n = 0; n < sa.positions.size(); n++) {
+      snprintf(num, sizeof(num), n ? " %u" : "%u", sa.positions[n]);
+      pos += num;
+    }
+    for (size_t n = 0; n < sa.dropped.size(); n++) {
+      snprintf(num, sizeof(num), n ? " %u" : "%u", sa.dropped[n]);
+      dropped += num;
+    }
+    snprintf(s, sizeof(s), "RFM_TQ_ALL pos='%s' tick='%u' dropped='%s'", pos.c_str(), sa.tick, dropped.c_str());
+  } else
+    snprintf(s, sizeof(s), "UNKNOWN type='0x%02X' len='%u'", f.type, (unsigned)f.payload.size());
+  return s;
+}
+
+bool parse_ack(const std::string &line, Ack &out)
+{
+  char id[32];
+  unsigned now, tick;
+  int rc, n = 0;
+
+  if (sscanf(line.c_str(), "ACK %31s rc='%d' now='%u' tick='%u'%n", id, &rc, &now, &tick, &n) == 4 && n) {
+    out.has_tick = true;
+    out.now = now;
+    out.tick = tick;
+  } else if (sscanf(line.c_str(), "ACK %31s rc='%d'%n", id, &rc, &n) == 2 && n)
+    out.has_tick = false;
+  else if (sscanf(line.c_str(), "NAK %31s rc='%d'%n", id, &rc, &n) == 2 && n)
+    out.has_tick = false;
+  else
+    return false;
+  if (id[0] != '#')
+    return false;
+  out.id = id;
+  out.ok = line[0] == 'A';
+  out.rc = rc;
+  if (!out.has_tick)
+    out.now = out.tick = 0;
+  return true;
+}
+
+} // namespace fht_tlm
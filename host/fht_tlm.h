@@ -0,0 +1,164 @@
+/*
+* Copyright 2013 Hynek Baran
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/*
+* Host side decoder of the FHT commander serial output.
+*
+* The serial stream carries text lines (CLI replies, LOG lines) mixed with
+* binary telemetry frames (see ../tlm.h).  Decoder takes the raw bytes and
+* returns complete text lines and verified frames; the typed payloads are
+* unpacked by the decode() functions below.
+*/
+
+#ifndef FHT_TLM_HOST_H_
+#define FHT_TLM_HOST_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "../tlm.h"
+
+namespace fht_tlm {
+
+/*! Dallas/Maxim CRC8, as _crc_ibutton_update() of avr-libc */
+uint8_t crc8_update(uint8_t crc, uint8_t data);
+
+/*! A verified frame, without framing, escapes and CRC */
+struct Frame {
+  uint8_t type;
+  std::vector<uint8_t> payload;
+};
+
+/*! Decoder statistics */
+struct Stats {
+  unsigned long frames;         /* good frames */
+  unsigned long lines;          /* text lines */
+  unsigned long crc_errors;     /* frames with bad CRC */
+  unsigned long framing_errors; /* truncated, too long or unterminated frames */
+};
+
+class Decoder {
+public:
+  /*! feed() results */
+  enum Result {
+    NONE,                       /* need more input */
+    FRAME,                      /* frame() holds a new frame */
+    TEXT,                       /* text() holds a new line (without CR/LF) */
+    ERROR                       /* a frame was dropped, see stats() */
+  };
+
+  /*! Longest frame accepted (type, payload and CRC) */
+  static const size_t MAX_FRAME = 64;
+
+  Decoder();
+
+  /*! Take one byte of the serial stream */
+  Result feed(uint8_t c);
+
+  const Frame &frame() const { return frame_; }
+  const std::string &text() const { return text_; }
+  const Stats &stats() const { return stats_; }
+
+  /*! Drop partial input, statistics are kept */
+  void reset();
+
+private:
+  Result end_frame();
+
+  bool in_frame_;
+  bool escape_;
+  std::vector<uint8_t> buf_;
+  std::string line_;
+  Frame frame_;
+  std::string text_;
+  Stats stats_;
+};
+
+/*! Unpacked payloads, fields as in ../tlm.h */
+struct FhtTx {
+  uint8_t group, hc1, hc2, address, command, extension;
+  uint16_t tick;
+};
+
+struct FhtTq {
+  uint8_t group, address, command, extension;
+  bool dropped;
+  uint8_t pending;
+  uint16_t tick;
+};
+
+struct FhtRx {
+  uint8_t hc1, hc2, address, command, extension;
+  int8_t rssi;
+};
+
+struct Temp {
+  uint8_t dev_type, dev_index;
+  int16_t t10;
+};
+
+struct Vcc {
+  uint8_t dev_type;
+  uint16_t mv;
+};
+
+struct Freeze {
+  uint8_t event, group;
+  int16_t t10;
+  uint16_t tick;
+};
+
+struct FhtSync {
+  uint8_t event, group, count;
+  uint16_t tick;
+};
+
+struct FhtSetAll {
+  uint16_t tick;
+  std::vector<uint8_t> positions;       /* groups 1, 2, ... */
+  std::vector<uint8_t> dropped;         /* groups not enqueued, 1-based */
+};
+
+/*! Unpack a frame, false if the type or the length does not match */
+bool decode(const Frame &f, FhtTx &out);
+bool decode(const Frame &f, FhtTq &out);
+bool decode(const Frame &f, FhtRx &out);
+bool decode(const Frame &f, Temp &out);
+bool decode(const Frame &f, Vcc &out);
+bool decode(const Frame &f, Freeze &out);
+bool decode(const Frame &f, FhtSetAll &out);
+bool decode(const Frame &f, FhtSync &out);
+
+/*! One line, key='value' description of a frame */
+std::string to_string(const Frame &f);
+
+/*! Reply to a CLI command sent with a request ID, "#<id> <command>" */
+struct Ack {
+  std::string id;               /* as sent, with the leading '#' */
+  bool ok;                      /* ACK, false for NAK */
+  int rc;                       /* handler result, -1 for an unknown command */
+  bool has_tick;                /* false for commands not sent on air */
+  uint16_t now, tick;           /* tick taken and tick sent on air (estimate) */
+};
+
+/*! Parse an ACK or NAK text line, false for other lines */
+bool parse_ack(const std::string &line, Ack &out);
+
+} // namespace fht_tlm
+
+#endif /* FHT_TLM_HOST_H_ */
@@ -0,0 +1,117 @@
+/*
+* Copyright 2013 Hynek Baran
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/*
+* Decode a captured RF stream with the streaming decoder of ../fht_codec.c.
+* The capture holds the raw RFM bytes (as read from the RX FIFO, MSB first),
+* the decoded frames are printed as "RX ..." lines, the decoder throughput
+* and error counters at the end.
+*
+*   ./rx_dump [-q] [-r <repeat>] <capture>
+*   ./rx_dump -g <frames> > capture     (synthetic capture of random frames)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "../fht_codec.h"
+
+static void usage(void)
+{
+  fprintf(stderr, "usage: rx_dump [-q] [-r <repeat>] <capture>\n"
+                  "       rx_dump -g <frames> > <capture>\n");
+  exit(2);
+}
+
+/* Random frames with a valid checksum, separated by an idle gap */
+static int generate(long frames)
+{
+  uint8_t msg[FHT_MSG_SIZE], out[64];
+
+  srand(1);
+  for (long n = 0; n < frames; n++) {
+    uint8_t checksum = 0x0c;
+    int len;
+
+    for (int i = 0; i < FHT_MSG_SIZE - 1; i++)
+      checksum += msg[i] = rand() & 0xff;
+    msg[FHT_MSG_SIZE - 1] = checksum;
+    len = fht_rfm_encode(msg, out, FHT_MSG_SIZE);
+    fwrite(out, 1, len, stdout);
+    fputc(0, stdout);
+  }
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  std::vector<uint8_t> data;
+  fht_dec_t dec;
+  bool quiet = false;
+  long repeat = 1;
+  unsigned long frames = 0;
+  int opt;
+  FILE *in;
+  clock_t t0;
+  double s;
+
+  while ((opt = getopt(argc, argv, "qr:g:")) != -1) {
+    switch (opt) {
+    case 'q': quiet = true; break;
+    case 'r': repeat = atol(optarg); break;
+    case 'g': return generate(atol(optarg));
+    default: usage();
+    }
+  }
+  if (optind != argc - 1 || repeat < 1)
+    usage();
+
+  if (!(in = fopen(argv[optind], "rb"))) {
+    perror(argv[optind]);
+    return 1;
+  }
+  for (int c; (c = fgetc(in)) != EOF; )
+    data.push_back((uint8_t)c);
+  fclose(in);
+
+  /* The file is decoded as one stream, repeated to get a measurable time */
+  fht_decode_init(&dec);
+  t0 = clock();
+  for (long r = 0; r < repeat; r++) {
+    for (size_t n = 0; n < data.size(); n++) {
+      if (fht_decode_byte(&dec, data[n]) != FHT_DEC_FRAME)
+        continue;
+      frames++;
+      if (quiet || r)
+        continue;
+      printf("RX hc='%u %u' adr='%u' cmd='0x%02X' ext='0x%02X' offset='%lu'\n",
+             dec.msg[0], dec.msg[1], dec.msg[2], dec.msg[3], dec.msg[4], (unsigned long)n);
+    }
+  }
+  s = (double)(clock() - t0) / CLOCKS_PER_SEC;
+
+  /* The error counters are 16 bit like on the AVR, they wrap on long runs */
+  fprintf(stderr, "bytes %lu frames %lu symbol_errors %u parity_errors %u checksum_errors %u\n",
+          (unsigned long)data.size() * repeat, frames, dec.symbol_errors, dec.parity_errors,
+          dec.checksum_errors);
+  if (s > 0)
+    fprintf(stderr, "%.0f frames/s %.1f MB/s\n", frames / s, data.size() * repeat / s / 1e6);
+  return 0;
+}
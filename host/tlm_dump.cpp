@@ -0,0 +1,56 @@
+/*
+* Copyright 2013 Hynek Baran
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/*
+* Decode a captured serial stream (or a tty) given as the argument or stdin,
+* text lines are passed through, frames are printed as "TLM ..." lines.
+*
+*   stty -F /dev/ttyUSB0 57600 raw && ./tlm_dump /dev/ttyUSB0
+*/
+
+#include <stdio.h>
+
+#include "fht_tlm.h"
+
+int main(int argc, char **argv)
+{
+  FILE *in = stdin;
+  fht_tlm::Decoder dec;
+  int c;
+
+  if (argc > 1 && !(in = fopen(argv[1], "rb"))) {
+    perror(argv[1]);
+    return 1;
+  }
+
+  while ((c = fgetc(in)) != EOF) {
+    switch (dec.feed((uint8_t)c)) {
+    case fht_tlm::Decoder::TEXT:
+      printf("%s\n", dec.text().c_str());
+      break;
+    case fht_tlm::Decoder::FRAME:
+      printf("TLM %s\n", fht_tlm::to_string(dec.frame()).c_str());
+      break;
+    default:
+      break;
+    }
+    fflush(stdout);
+  }
+
+  fprintf(stderr, "frames %lu lines %lu crc_errors %lu framing_errors %lu\n",
+          dec.stats().frames, dec.stats().lines, dec.stats().crc_errors, dec.stats().framing_errors);
+  return 0;
+}
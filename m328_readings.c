@@ -3,6 +3,7 @@
 
 #include "common.h"
 #include "temp.h"
+#include "tlm.h"
 
 
 #include <Arduino.h> // ???
@@ -50,6 +51,15 @@ void m328_print_readings(void) {
   temp = m328_read_Temp();
   vcc = m328_read_Vcc();
   
+  if (tlm_is_enabled()) {
+    tlm_vcc_t v;
+
+    tlm_temp(TLM_DEV_M328, 0, (int16_t)(temp / 1000));
+    v.dev_type = TLM_DEV_M328;
+    v.mv = vcc;
+    tlm_send(TLM_VCC, &v, sizeof(v));
+    return;
+  }
   MSG_TMP("LOCAL value='"); temp_print_value_long(temp,10000);  PRINTF("' unit='C' dev_type='m328'\n");
   MSG("VCC LOCAL value='%ld' unit='mV' dev_type='m328'\n", vcc);
 }
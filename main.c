@@ -34,12 +34,14 @@
 
 #include "si443x_min.h"
 #include "fht.h"
+#include "fht_sub.h"
 #include "cli.h"
 
 #include "board.h"
 #include "common.h"
 
 #include "temp.h"
+#include "tlm.h"
 
 #include "MemoryFree.h"
 
@@ -51,13 +53,40 @@
 
 static volatile uint32_t g_tick_count;
 
+/* Runtime log threshold, see LOG_ENABLED() */
+#ifndef LOG_LEVEL_DEFAULT
+#define LOG_LEVEL_DEFAULT	LOG_LEVEL_MAX
+#endif
+uint8_t g_log_level = LOG_LEVEL_DEFAULT;
+
+/* Tick period in timer 1 counts.  The timer runs free, each tick moves the
+   compare match one period ahead, so the counter tells how many ticks a
+   long handler has lost (up to 3, the counter wraps in 4.2 periods). */
+#define TICK_PERIOD		(F_CPU / 256 / SYSTEM_TICK)
+/* A compare match this close is taken as passed already [timer counts] */
+#define TICK_MARGIN		32
+
 /* Half second tick interrupt */
 ISR(TIMER1_COMPA_vect)
 {
+  uint16_t due = OCR1A;
+  uint8_t lost;
+
   g_tick_count++;
 
   /* Run half-second FHT driver jobs */
   fht_tick();
+
+  /* Compare matches passed while fht_tick() ran are lost ticks, they are
+     counted here and caught up by the next fht_tick() */
+  lost = (uint16_t)(TCNT1 - due + TICK_MARGIN) / TICK_PERIOD;
+  if (lost) {
+    g_tick_count += lost;
+    fht_tick_missed(lost);
+    fht_tick_overrun();
+  }
+  OCR1A = due + (lost + 1) * TICK_PERIOD;
+  TIFR1 = _BV(OCF1A);
 }
 
 uint32_t get_tick_count(void)
@@ -90,11 +119,13 @@ static int fht_handler(cli_t *ctx, void *arg, int argc, char **argv)
   uint8_t value;
   grp_name_t groupname;
   grp_indx_t group;
+  uint8_t sub;
+  uint16_t now, eta;
 
   /*
     Every command has a form fht <cmd> <group> [<optional_params>]
     where group is name of the group in quastion.
-    Group names are 1, 2, 3, ... but internally C array indices are 0, 1, 2,  ... so in g_message are indices shifted by 1.
+    Group names are 1, 2, 3, ... but internally C array indices are 0, 1, 2,  ... so in the group table are indices shifted by 1.
     Group name 0 is moreover reserved for "all groups" (not implemented yet).
   */
 
@@ -102,6 +133,26 @@ static int fht_handler(cli_t *ctx, void *arg, int argc, char **argv)
     LOG_CLI("Missing parameter.\n");
     return 1;
   }
+  sub = fht_sub_find(argv[1]);
+
+  if (sub == FHT_SUB_SETALL) {
+    // *** SETALL ***
+    // 'setall' takes the valve positions of groups 1, 2, ... [decimal]
+    uint8_t values[FHT_GROUPS_DIM];
+    int n;
+
+    if (argc < 3 || argc - 2 > fht_get_groups_num()) {
+      LOG_CLI("Error: give 1 to %u valve positions.\n", fht_get_groups_num());
+      return 1;
+    }
+    for (n = 2; n < argc; n++)
+      values[n - 2] = atoi(argv[n]);
+    now = fht_get_ticks();
+    eta = fht_set_all(values, argc - 2);
+    cli_ack_tick(ctx, now, eta);
+    fht_cancel_panic();
+    return 0;
+  }
 
   if (argc == 2) {
     // no groupname means all (if no additional parameters present)
@@ -116,118 +167,194 @@ static int fht_handler(cli_t *ctx, void *arg, int argc, char **argv)
 
   group = grp_name2indx(groupname);
 
-  if ((strcmp_PF(argv[1], PSTR("hc")) == 0) || (strcmp_PF(argv[1], PSTR("hcd")) == 0) ||  (strcmp_PF(argv[1], PSTR("hch")) == 0)) {
-    // *** HomeCode ***
-    // hc, hcd .. dec, hch .. hex
-    uint8_t hc1, hc2;
-
-    if (argc < 5) return 2;
-    if (TestIfGrpIsAll(groupname)) return 1;
-
-    /* 'hc' takes two arguments which are the two house codes for
-       the valve with which we are pairing e.g.
-       > fht hc 12 34
-    */
-
-    if (strcmp_PF(argv[1], PSTR("hch")) == 0) { // hex
-      hc1 = strtol(argv[3], 0, 16);
-      hc2 = strtol(argv[4], 0, 16);
-    } else { // dec
-      hc1 = atoi(argv[3]);
-      hc2 = atoi(argv[4]);
+  switch (sub) {
+    case FHT_SUB_HC:
+    case FHT_SUB_HCD:
+    case FHT_SUB_HCH: {
+      // *** HomeCode ***
+      // hc, hcd .. dec, hch .. hex
+      uint8_t hc1, hc2;
+
+      if (argc < 5) return 2;
+      if (TestIfGrpIsAll(groupname)) return 1;
+
+      /* 'hc' takes two arguments which are the two house codes for
+         the valve with which we are pairing e.g.
+         > fht hc 12 34
+      */
+
+      if (sub == FHT_SUB_HCH) { // hex
+        hc1 = strtol(argv[3], 0, 16);
+        hc2 = strtol(argv[4], 0, 16);
+      } else { // dec
+        hc1 = atoi(argv[3]);
+        hc2 = atoi(argv[4]);
+      }
+
+      fht_set_hc_grp(group, hc1, hc2);
+      fht_config_save_group(group);
+      LOG_CLI("Home code of group %u was set to %u %uhc='%u %u'='0x%X 0x%X'.\n", groupname, hc1, hc2, hc1, hc2);
+      break;
+    }
+    case FHT_SUB_PAIR: {
+      // *** PAIR ***
+      uint8_t valve;
+      if (TestIfGrpIsAll(groupname)) return 1;
+      if (argc = 4) {
+        // valve number specified: fht pair <group> <valve>
+        valve = atoi(argv[3]);
+      } else {
+        // valve index no specified: fht pair <group>
+        valve = 0;
+      }
+      LOG_CLI("Requesting group %u valve %u pairing\n", groupname, valve);
+      now = fht_get_ticks();
+      eta = fht_enqueue(group, valve, FHT_PAIR, 0);
+      cli_ack_tick(ctx, now, eta);
+      break;
+    }
+    case FHT_SUB_SYNC:
+      // *** SYNC ***
+      LOG_CLI("Syncing group %u valves\n", groupname);
+      now = fht_get_ticks();
+      eta = fht_sync(group);
+      cli_ack_tick(ctx, now, eta);
+      break;
+    case FHT_SUB_SET:
+    case FHT_SUB_SETH:
+    case FHT_SUB_SETP:
+      if (argc < 4) return 1;
+      // 'set' takes one argument which is the valve position in the range 0 to 255 [decimal]
+      // 'seth' takes one argument which is the valve position in the range 0 to FF [hex]
+      // 'setp' takes one argument which is the valve position in the range 0 to 100 [decimal, %]
+      if (sub == FHT_SUB_SETP) value = ((uint16_t) atoi(argv[3]))*100/255; // dec %
+      else  if (sub == FHT_SUB_SETH)   value = strtol(argv[3], 0, 16); // hex
+      else  value = atoi(argv[3]); // dec
+
+      LOG_CLI("Setting group %u valve position to 0x%X\n", groupname, value);
+      now = fht_get_ticks();
+      eta = fht_enqueue(group, 0, FHT_VALVE_SET, value);
+      cli_ack_tick(ctx, now, eta);
+      fht_cancel_panic();
+      break;
+    case FHT_SUB_OFFSET: {
+      // *** OFFSET ***
+      // not properly tested yet
+      if (argc < 5) return 1;
+      uint8_t valve = atoi(argv[3]); // valve number
+      int8_t  offset_sdec = atoi(argv[4]); // offset (signed decimal value of offset)
+      // according FHEM/11_FHT.pm, to be changed as follows:  $val = "offset: " . ($val>128?(128-$val):$val) }
+      value = abs(offset_sdec);
+      if (offset_sdec < 0) value |= 0b10000000;
+      LOG_CLI("Setting group %u valve %u offset to %d = 0x%x\n", groupname, valve, offset_sdec, value);
+      now = fht_get_ticks();
+      eta = fht_enqueue(group, valve, FHT_OFFSET, value);
+      cli_ack_tick(ctx, now, eta);
+      break;
+    }
+    case FHT_SUB_GROUPS:
+      // *** GROUPS ***
+      /* set number of currently used groups
+                     this command has no groupname parameter
+                     so the number of groups is in groupname parameter
+      */
+      if (groupname < 1 || groupname > FHT_GROUPS_DIM) {
+        LOG_CLI("Error: %u is out of the range [1, FHT_GROUPS_DIM=%u].\n", groupname, FHT_GROUPS_DIM);
+        return 1;
+      }
+      fht_set_groups_num(groupname);
+      LOG_CLI("Number of active groups is set to %u.\n", groupname);
+      LOG_FHT(2, "CLI Please setup home codes for new groups! Call: fht hc <group> <hc1> <hc2>\n");
+      break;
+    case FHT_SUB_BEEP:
+      // *** BEEP ***
+      /* 'beep' will instruct the valve to make a beep */
+      LOG_CLI("Requesting group %u valve test beep\n", groupname);
+      now = fht_get_ticks();
+      eta = fht_enqueue(group, 0, FHT_TEST, 0);
+      cli_ack_tick(ctx, now, eta);
+      break;
+    case FHT_SUB_INFO:
+      // *** INFO ***
+      fht_print();
+      break;
+    case FHT_SUB_STATS: {
+      // *** STATS ***
+      debug_stats_t uart;
+
+      fht_print_stats();
+      debug_get_stats(&uart);
+      PRINTF("UART TX buffer full: %u, chars dropped: %u\n", uart.tx_full, uart.tx_dropped);
+      PRINTF("UART RX chars dropped: %u, overruns: %u, framing errors: %u\n", uart.rx_dropped, uart.rx_overrun, uart.rx_frame);
+      break;
     }
+    case FHT_SUB_IDLE:
+      // *** IDLE ***
+      fht_cancel_panic();
+      LOG_CLI("IDLE.\n")
+      break;
+    default:
+      LOG_CLI("Unknown fht command.\n");
+      return 1;
+  }
+
+  return 0;
+}
 
-    fht_set_hc_grp(group, hc1, hc2);
-    fht_config_save_group(group);
-    LOG_CLI("Home code of group %u was set to %u %uhc='%u %u'='0x%X 0x%X'.\n", groupname, hc1, hc2, hc1, hc2);
-
-  } else if (strcmp_PF(argv[1], PSTR("pair")) == 0) {
-    // *** PAIR ***
-    uint8_t valve;
-    if (TestIfGrpIsAll(groupname)) return 1;
-    if (argc = 4) {
-      // valve number specified: fht pair <group> <valve>
-      valve = atoi(argv[3]);
+
+/* Background FHT receiver control, prints frames received so far */
+static int fhtrx_handler(cli_t *ctx, void *arg, int argc, char **argv)
+{
+  if (argc > 1) {
+    if (strcmp_PF(argv[1], PSTR("on")) == 0) {
+      if (si443x_status() != 0) {
+        LOG_CLI("Radio not initialized.\n");
+        return 1;
+      }
+      fht_rx_enable(True);
+      LOG_CLI("FHT receiver on.\n");
+    } else if (strcmp_PF(argv[1], PSTR("off")) == 0) {
+      fht_rx_enable(False);
+      LOG_CLI("FHT receiver off.\n");
     } else {
-      // valve index no specified: fht pair <group>
-      valve = 0;
-    }
-    LOG_CLI("Requesting group %u valve %u pairing\n", groupname, valve);
-    fht_enqueue(group, valve, FHT_PAIR, 0);
-  } else if (strcmp_PF(argv[1], PSTR("sync")) == 0) {
-    // *** SYNC ***
-    LOG_CLI("Syncing group %u valves\n", groupname);
-    fht_sync(group);
-  } else if ((strcmp_PF(argv[1], PSTR("set")) == 0) || strcmp_PF(argv[1], PSTR("seth")) == 0  || strcmp_PF(argv[1], PSTR("setp")) == 0) {
-    if (argc < 4) return 1;
-    // 'set' takes one argument which is the valve position in the range 0 to 255 [decimal]
-    // 'seth' takes one argument which is the valve position in the range 0 to FF [hex]
-    // 'setp' takes one argument which is the valve position in the range 0 to 100 [decimal, %]
-    if (strcmp_PF(argv[1], PSTR("setp")) == 0) value = ((uint16_t) atoi(argv[3]))*100/255; // dec %
-    else  if (strcmp_PF(argv[1], PSTR("seth")) == 0)   value = strtol(argv[3], 0, 16); // hex
-    else  value = atoi(argv[3]); // dec
-
-    LOG_CLI("Setting group %u valve position to 0x%X\n", groupname, value);
-    fht_enqueue(group, 0, FHT_VALVE_SET, value);
-    fht_cancel_panic();
-  } else if (strcmp_PF(argv[1], PSTR("offset")) == 0) {
-    // *** OFFSET ***
-    // not properly tested yet
-    if (argc < 5) return 1;
-    uint8_t valve = atoi(argv[3]); // valve number
-    int8_t  offset_sdec = atoi(argv[4]); // offset (signed decimal value of offset)
-    // according FHEM/11_FHT.pm, to be changed as follows:  $val = "offset: " . ($val>128?(128-$val):$val) }
-    value = abs(offset_sdec);
-    if (offset_sdec < 0) value |= 0b10000000;
-    LOG_CLI("Setting group %u valve %u offset to %d = 0x%x\n", groupname, valve, offset_sdec, value);
-    fht_enqueue(group, valve, FHT_OFFSET, value);
-  } else if (strcmp_PF(argv[1], PSTR("groups")) == 0) {
-    // *** GROUPS ***
-    /* set number of currently used groups
-                   this command has no groupname parameter
-                   so the number of groups is in groupname parameter
-    */
-    if (groupname < 1 || groupname > FHT_GROUPS_DIM) {
-      LOG_CLI("Error: %u is out of the range [1, FHT_GROUPS_DIM=%u].\n", groupname, FHT_GROUPS_DIM);
       return 1;
     }
-    fht_set_groups_num(groupname);
-    LOG_CLI("Number of active groups is set to %u.\n", groupname);
-    LOG_FHT("2 CLI Please setup home codes for new groups! Call: fht hc <group> <hc1> <hc2>\n");
-  } else if (strcmp_PF(argv[1], PSTR("beep")) == 0) {
-    // *** BEEP ***
-    /* 'beep' will instruct the valve to make a beep */
-    LOG_CLI("Requesting group %u valve test beep\n", groupname);
-    fht_enqueue(group, 0, FHT_TEST, 0);
-  } else if (strcmp_PF(argv[1], PSTR("info")) == 0) {
-    // *** INFO ***
-    fht_print();
-  }  else if (strcmp_PF(argv[1], PSTR("idle")) == 0) {
-    // *** IDLE ***
-    fht_cancel_panic();
-    LOG_CLI("IDLE.\n")
-  } else  {
-    LOG_CLI("Unknown fht command.\n");
-    return 1;
   }
-
+  fht_receive();
   return 0;
 }
 
 
-//static int fhtrx_handler(cli_t *ctx, void *arg, int argc, char **argv)
-//{
-//	DPRINTF("FHT test receiver started - reset to exit\n");
-//
-//	/* Disable timer to inhibit transmitter */
-//	TIMSK1 = 0;
-//
-//	while (1) {
-//		fht_receive();
-//	}
-//	return 0;
-//}
+/* Binary telemetry mode control */
+static int tlm_handler(cli_t *ctx, void *arg, int argc, char **argv)
+{
+  if (argc > 1) {
+    if (strcmp_PF(argv[1], PSTR("on")) == 0)
+      tlm_enable(True);
+    else if (strcmp_PF(argv[1], PSTR("off")) == 0)
+      tlm_enable(False);
+    else
+      return 1;
+  }
+  LOG_CLI("Binary telemetry %S.\n", tlm_is_enabled() ? PSTR("on") : PSTR("off"));
+  return 0;
+}
+
+/* Runtime log threshold */
+static int log_handler(cli_t *ctx, void *arg, int argc, char **argv)
+{
+  if (argc > 1) {
+    int level = atoi(argv[1]);
 
+    if (level < 0 || level > LOG_LEVEL_MAX) {
+      LOG_CLI("Error: log level %d is out of the range [0, LOG_LEVEL_MAX=%u].\n", level, LOG_LEVEL_MAX);
+      return 1;
+    }
+    g_log_level = level;
+  }
+  LOG_CLI("Log level is %u.\n", g_log_level);
+  return 0;
+}
 
 static int temp_handler(cli_t *ctx, void *arg, int argc, char **argv)
 {
@@ -281,27 +408,28 @@ int fhtsetup(void)
 
   /* Configure tick interrupt for half second from internal
      8 MHz clock using timer 1 */
-  TCCR1A = 0; /* CTC mode */
-  TCCR1B = _BV(WGM12) | _BV(CS12); /* divide by 256 */
-  OCR1A = F_CPU / 256 / SYSTEM_TICK - 1;
+  TCCR1A = 0; /* normal mode, the interrupt advances OCR1A */
+  TCCR1B = _BV(CS12); /* divide by 256 */
+  TCNT1 = 0;
+  OCR1A = TICK_PERIOD;
   TIMSK1 = _BV(OCIE1A);
 
   sei();
 
   /* Turn on radio module */
-  LOG_FHT("2 RADIO Enabling radio...\n");
+  LOG_FHT(2, "RADIO Enabling radio...\n");
   TRX_ON();
   _delay_ms(30);
   int radioStatus = si443x_init();
   if (radioStatus < 0) { // TODO: set global variable with radio status
 #ifdef TRX_SDN
-    LOG_FHT("1 RADIO FAILED,  RFM chip TRX_SDN pin defined, connect it correctly (or ground it)!\n");
+    LOG_FHT(1, "RADIO FAILED,  RFM chip TRX_SDN pin defined, connect it correctly (or ground it)!\n");
 #else
-    LOG_FHT("1 RADIO FAILED\n");
+    LOG_FHT(1, "RADIO FAILED\n");
 #endif
     //while (1);
   } else {
-    LOG_FHT("1 RADIO OK\n\n");
+    LOG_FHT(1, "RADIO OK\n\n");
     LED_GREEN_OFF();
     LED_TRX_OFF();
     LED_RED_OFF();
@@ -313,10 +441,12 @@ int fhtsetup(void)
   fht_print();
 
   /* Set up CLI */
-  cli_init(stdin, stdout, PSTR("FHT"));
+  cli_init(stdin, stdout, debug_poll, PSTR("FHT"));
   cli_register_command(PSTR("fht"), fht_handler, NULL,
-                       PSTR("fht groups <num_of_groups> | hc <grp> <hc1> <hc2> | pair <grp> [<valve>] | sync [<grp>] | offset  <grp> <valve> <value> | set <grp> <pos> | beep <grp> | info "));
-  //cli_register_command(PSTR("fhtrx"), fhtrx_handler, NULL, PSTR("fhtrx - start receiver"));
+                       PSTR("fht groups <num_of_groups> | hc <grp> <hc1> <hc2> | pair <grp> [<valve>] | sync [<grp>] | offset  <grp> <valve> <value> | set <grp> <pos> | setall <pos1> .. <posN> | beep <grp> | info | stats "));
+  cli_register_command(PSTR("fhtrx"), fhtrx_handler, NULL, PSTR("fhtrx [on|off] - background receiver, print received frames"));
+  cli_register_command(PSTR("tlm"), tlm_handler, NULL, PSTR("tlm [on|off] - binary telemetry frames instead of text events"));
+  cli_register_command(PSTR("log"), log_handler, NULL, PSTR("log [<level>] - print log messages up to level 0 (events), 1 (info) or 2 (verbose)"));
   cli_register_command(PSTR("tmp"), temp_handler, NULL, PSTR("tmp - read the temperatures"));
 
 
@@ -329,7 +459,7 @@ int fhtsetup(void)
 
     LOG_CLI("Syncing all group valves...\n");
     fht_sync(grp_indx_all);
-    LOG_CLI("Sync done.\n");
+    LOG_CLI("Sync started, groups log SYNC DONE in about 2 minutes.\n");
 
     LOG_CLI("Setting all group valves to 0x%X...\n", FHT_SYNC_SET_VALUE);
     fht_enqueue(grp_indx_all, 0, FHT_VALVE_SET, FHT_SYNC_SET_VALUE);
@@ -338,8 +468,14 @@ int fhtsetup(void)
   }
   return radioStatus;
 }
+/* Cooperative main loop, called over and over.  None of the tasks blocks,
+   each does the work pending and returns. */
 int fhtloop() {
-  cli_task(); /* never returns */
+  cli_task();
+  fht_tx_task();
+  fht_log_task();
+  temp_task();
+  return 0;
 }
 
 
@@ -348,6 +484,7 @@ int fhtloop() {
   {
 	fhtsetup();
         temp_init();
-	fhtloop();
+	for (;;)
+		fhtloop();
   }
 */
@@ -35,6 +35,7 @@
 #include "board.h"
 #include "common.h"
 #include "temp.h"
+#include "tlm.h"
 
 static int radioStatus = 1 ; // 0=OK 1=not initialized 2=failed
 
@@ -185,6 +186,7 @@ int si443x_status(void)
 										}
 
 #define SI443X_SET_RX_FIFO_FULL_THRESH(n)	si443x_write8(R_RX_FIFO_CTRL, (n) & RXAFTHR_MASK)
+#define SI443X_SET_TX_FIFO_EMPTY_THRESH(n)	si443x_write8(R_TX_FIFO_CTRL2, (n) & TXFAETHR_MASK)
 
 /* Radio parameters */
 
@@ -374,19 +376,19 @@ int si443x_init(void)
 	/* Check for supported device */
 	device = SI443X_DEVICE_TYPE();
 	version = SI443X_DEVICE_VERSION();
-	LOG_FHT("1 RADIO Found device type %d version %d\n", device, version);
+	LOG_FHT(1, "RADIO Found device type %d version %d\n", device, version);
 	if (device != SUPPORTED_DEVICE_TYPE || version != SUPPORTED_DEVICE_VERSION) {
-		LOG_FHT("1 RADIO ERROR: Unsupported/missing radio\n");
+		LOG_FHT(1, "RADIO ERROR: Unsupported/missing radio\n");
 		radioStatus = -1;
 		return -1;
 	}
 
 	/* Software reset - poll for completion */
-	LOG_FHT("2 RADIO Resetting radio...\n");
+	LOG_FHT(2, "RADIO Resetting radio...\n");
 	SI443X_SWRESET();
 	while (INP(nIRQ));
 	SI443X_STATUS(); /* Clear interrupt flag */
-	LOG_FHT("2 RADIO Done\n");
+	LOG_FHT(2, "RADIO Done\n");
 
 	/* Go to standby */
 	si443x_standby();
@@ -431,114 +433,242 @@ int si443x_init(void)
 	return 0;
 }
 
-int si443x_receive(uint8_t *data, uint8_t data_length, int timeout, int *rssi)
+/*******************************/
+/* Interrupt driven receiver   */
+/*******************************/
+
+/*! Number of bytes passed to the receive handler at once */
+#define RX_CHUNK			8
+
+/*! A streamed transmission is refilled when this many bytes are left in the
+ * FIFO (16 bytes is 25 ms on air at 5 kbps) */
+#define TX_REFILL_THRESH	16
+
+static si443x_rx_handler_t rx_handler;
+static int8_t rx_rssi;
+
+static uint8_t tx_length;
+/*! Set from si443x_tx_begin() until the packet sent interrupt */
+static volatile uint8_t tx_busy;
+/*! Supplies the rest of a streamed transmission, NULL when exhausted */
+static si443x_tx_source_t tx_source;
+/*! Streamed transmissions cut short by a FIFO underflow */
+static volatile uint16_t tx_underruns;
+
+/*! Write up to n bytes from the source into the FIFO, the source is
+ * dropped when it runs out of data */
+static void si443x_tx_fill(uint8_t n)
 {
-	uint32_t give_up_time = get_tick_count() + timeout;
+	uint8_t byte;
 
-	if (data_length > FIFO_SIZE) {
-		DPRINTF("Packet too large\n");
-		return -1;
+	SELECT();
+	si443x_io(R_FIFO | WRITE);
+	while (n && tx_source) {
+		if (tx_source(&byte)) {
+			si443x_io(byte);
+			n--;
+		} else {
+			tx_source = NULL;
+		}
 	}
+	DESELECT();
+}
 
-	/* Get into known state, clear FIFOs */
+/*! Clear FIFOs and (re)start hunting for the sync word */
+static void si443x_rx_arm(void)
+{
 	si443x_standby();
 
-	/* Set FIFO threshold to desired length */
-	SI443X_SET_RX_FIFO_FULL_THRESH(data_length - 1);
+	/* Set FIFO threshold to the chunk length */
+	SI443X_SET_RX_FIFO_FULL_THRESH(RX_CHUNK - 1);
 
-	/* Enable interrupt flag on sync detect */
-	si443x_write16(R_INT_ENABLE, ENSWDET);
+	/* Enable interrupt on sync detect and FIFO threshold */
+	si443x_write16(R_INT_ENABLE, ENSWDET | ENRXFFAFULL);
 
 	/* Enter receive mode */
-	DPRINTF("Waiting for rx\n");
 	SI443X_STATUS(); /* clear status */
 	SI443X_MODE_RX();
+}
 
-	/* Wait for received sync or timeout */
-	while (INP(nIRQ)) {
-		if (timeout && get_tick_count() >= give_up_time) {
-			DPRINTF("Rx timed out\n");
-			goto abort;
-		}
+void si443x_rx_start(si443x_rx_handler_t handler)
+{
+	uint8_t sreg = SREG;
+
+	cli();
+	rx_handler = handler;
+	/* A transmission in progress keeps the radio, the receiver is
+	 * restarted after it */
+	if (!tx_busy) {
+		si443x_rx_arm();
+		nTRX_IRQ_PCMSK |= MASK(nIRQ);
+		PCICR |= _BV(nTRX_IRQ_PCIE);
 	}
-	SI443X_STATUS(); /* clear status */
-	DPRINTF("Synced\n");
+	SREG = sreg;
+}
 
-	/* Save rssi */
-	*rssi = SI443X_RSSI();
+void si443x_rx_stop(void)
+{
+	uint8_t sreg = SREG;
 
-	/* Enable interrupt on FIFO threshold */
-	si443x_write16(R_INT_ENABLE, ENRXFFAFULL);
+	cli();
+	rx_handler = NULL;
+	if (!tx_busy) {
+		nTRX_IRQ_PCMSK &= ~MASK(nIRQ);
+		si443x_standby();
+	}
+	SREG = sreg;
+}
 
-	/* Receive until required number of bytes received */
-	while (INP(nIRQ)) {
-		if (timeout && get_tick_count() >= give_up_time) {
-			DPRINTF("Rx timed out\n");
-			goto abort;
+/*! nIRQ pin change - the pin is active low */
+ISR(nTRX_IRQ_vect)
+{
+	uint8_t buf[RX_CHUNK];
+	uint16_t status;
+	uint8_t n;
+
+	if (INP(nIRQ))
+		return;
+
+	if (tx_busy) {
+		status = SI443X_STATUS();
+		if (tx_source && (status & (IPKSENT | IFFERR))) {
+			/* The FIFO ran dry before the source was done (the refill
+			 * came too late), the packet went out truncated */
+			tx_underruns++;
+			tx_source = NULL;
+			si443x_standby();
+			tx_busy = 0;
+		} else if (status & IPKSENT) {
+			/* Packet sent - the transmitter is done with the bus */
+			si443x_standby();
+			tx_busy = 0;
+		} else if ((status & ITXFFAEM) && tx_source) {
+			/* Top up the FIFO, stop refilling once the source is done */
+			si443x_tx_fill(FIFO_SIZE - TX_REFILL_THRESH - 1);
+			if (tx_source == NULL)
+				si443x_write16(R_INT_ENABLE, ENPKSENT);
 		}
+		return;
 	}
-	SI443X_STATUS(); /* clear status */
 
-	/* Turn off receiver but don't flush FIFOs */
-	SI443X_MODE_STANDBY();
+	if (rx_handler == NULL)
+		return;
 
-	/* Read the requested number of bytes from the FIFO */
-	DPRINTF("receiving 0x%X bytes\n", data_length);
+	status = SI443X_STATUS();
 
-	/* Read from FIFO */
-	SELECT();
-	si443x_io(R_FIFO | READ);
-	while (data_length--) {
-		*data++ = si443x_io(0);
+	if (status & ISWDET) {
+		/* Save rssi and tell the handler a new packet starts */
+		rx_rssi = SI443X_RSSI();
+		rx_handler(buf, 0, rx_rssi);
 	}
-	DESELECT();
 
-	/* Clean up*/
-	si443x_standby();
-	return 0;
+	if (status & IRXFFAFULL) {
+		/* Read from FIFO */
+		SELECT();
+		si443x_io(R_FIFO | READ);
+		for (n = 0; n < RX_CHUNK; n++)
+			buf[n] = si443x_io(0);
+		DESELECT();
 
-abort:
-	si443x_standby();
-	return -1;
+		if (rx_handler(buf, RX_CHUNK, rx_rssi))
+			si443x_rx_arm();
+	}
 }
 
-int si443x_transmit(uint8_t *data, uint8_t data_length)
+void si443x_tx_begin(void)
 {
-	if (data_length > FIFO_SIZE) {
-		DPRINTF("Packet too large\n");
-		return -1;
-	}
+	/* Stop the background receiver, its interrupt would collide on SPI */
+	tx_busy = 1;
+	nTRX_IRQ_PCMSK &= ~MASK(nIRQ);
 
 	/* Get into known state, clear FIFOs */
 	si443x_standby();
 
-	/* Push data to FIFO */
-	//DPRINTF("Writing 0x%X bytes to tx FIFO\n", data_length);
+	/* Open FIFO write burst */
+	tx_length = 0;
 	SELECT();
 	si443x_io(R_FIFO | WRITE);
-	while (data_length--) {
-		si443x_io(*data++);
+}
+
+void si443x_tx_put(uint8_t byte)
+{
+	/* Bytes beyond the FIFO size are dropped */
+	if (tx_length < FIFO_SIZE) {
+		si443x_io(byte);
+		tx_length++;
 	}
+}
+
+int si443x_tx_commit(void)
+{
+	return si443x_tx_commit_stream(NULL);
+}
+
+int si443x_tx_commit_stream(si443x_tx_source_t source)
+{
 	DESELECT();
 
-	/* Enable interrupt flag on packet sent */
-	si443x_write16(R_INT_ENABLE, ENPKSENT);
+	/* Fill the rest of the FIFO from the source */
+	tx_source = source;
+	si443x_tx_fill(FIFO_SIZE - tx_length);
+
+	/* Enable interrupt flag on packet sent, and on FIFO almost
+	 * empty (and underflow) while there is more to send */
+	if (tx_source) {
+		SI443X_SET_TX_FIFO_EMPTY_THRESH(TX_REFILL_THRESH);
+		si443x_write16(R_INT_ENABLE, ENPKSENT | ENTXFFAEM | ENFFERR);
+	} else {
+		si443x_write16(R_INT_ENABLE, ENPKSENT);
+	}
 
 	/* Start transmitter - in raw FIFO mode the tx will
 	 * run until the FIFO has been drained.  The length register
-	 * does not need to be programmed. */
+	 * does not need to be programmed, a streamed packet must be
+	 * refilled before the FIFO runs dry. */
 	//DPRINTF("Enabling tx\n");
 	SI443X_STATUS();
 	SI443X_MODE_TX();
 
-	/* Wait for completion - poll interrupt pin */
-	while (INP(nIRQ));
-	si443x_standby();
-	//if (DEBUG > 1) DPRINTF("Tx complete\n");
+	/* Completion is signalled by nIRQ, the pin change interrupt
+	 * returns the radio to standby and clears tx_busy */
+	nTRX_IRQ_PCMSK |= MASK(nIRQ);
+	PCICR |= _BV(nTRX_IRQ_PCIE);
 
 	return 0;
 }
 
+uint8_t si443x_tx_busy(void)
+{
+	return tx_busy;
+}
+
+uint16_t si443x_tx_underruns(void)
+{
+	uint8_t sreg = SREG;
+	uint16_t n;
+
+	cli();
+	n = tx_underruns;
+	SREG = sreg;
+	return n;
+}
+
+int si443x_transmit(uint8_t *data, uint8_t data_length)
+{
+	if (data_length > FIFO_SIZE) {
+		DPRINTF("Packet too large\n");
+		return -1;
+	}
+
+	/* Push data to FIFO */
+	//DPRINTF("Writing 0x%X bytes to tx FIFO\n", data_length);
+	si443x_tx_begin();
+	while (data_length--) {
+		si443x_tx_put(*data++);
+	}
+	return si443x_tx_commit();
+}
+
 void si443x_dump(void)
 {
 	uint8_t val;
@@ -565,6 +695,8 @@ void si443x_dump(void)
 */
 int16_t si443x_get_temperature(void) {
   
+        // the transmitter may own the SPI bus (when called from ISR)
+        if (tx_busy) return TEMP_NA;
         cli();
         // set adc input and reference
         si443x_write8(0x0f, 0x00 | (1 << 6) | (1 << 5) | (1 << 4));
@@ -589,7 +721,11 @@ int16_t si443x_temp_print(void)
 {
    int16_t t10 = si443x_get_temperature();
    // print data message
-   MSG_TMP("LOCAL value='"); temp_print_value(t10); PRINTF("' unit='C' raw='%x' dev_type='si443'\n", t10);   
+   if (tlm_is_enabled())
+      tlm_temp(TLM_DEV_SI443, 0, t10);
+   else {
+      MSG_TMP("LOCAL value='"); temp_print_value(t10); PRINTF("' unit='C' raw='%x' dev_type='si443'\n", t10);
+   }
    
    return (t10);
 }
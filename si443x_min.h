@@ -49,23 +49,60 @@ int si443x_status(void);
  */
 int si443x_init(void);
 
-/*! Receive a packet, blocking until one is available.  Packets must start with
- * preamble and the currently selected sync word.
- * \param	data			Pointer to buffer large enough for received packet
- * \param	data_length		Size of data buffer (max 64 bytes)
- * \param	timeout			Timeout (in system ticks)
- * \param	rssi			Pointer to variable to be populated with RSSI (signal strength)
- * \return					0 on success, -1 on error (timeout)
+/*! Receive handler, called from the nIRQ interrupt.
+ * \param	data			Received bytes (encoded stream following the sync word)
+ * \param	data_length		Number of bytes, 0 when a new packet starts (sync detected)
+ * \param	rssi			Signal strength (dBm) latched at sync detect
+ * \return					Non-zero to drop the rest of the packet and hunt for the next sync
+ */
+typedef uint8_t (*si443x_rx_handler_t)(uint8_t *data, uint8_t data_length, int8_t rssi);
+
+/*! Start the background receiver.  Packets must start with preamble and the
+ * currently selected sync word, received data are passed to the handler
+ * in small chunks from the nIRQ pin change interrupt.
+ * A transmission stops the receiver, it must be restarted afterwards.
+ * \param	handler			Receive handler
  */
-int si443x_receive(uint8_t *data, uint8_t data_length, int timeout, int *rssi);
+void si443x_rx_start(si443x_rx_handler_t handler);
 
-/*! Transmit a packet, blocking until complete
+/*! Stop the background receiver and return to standby */
+void si443x_rx_stop(void);
+
+/*! Start transmitting a packet, completion is reported by si443x_tx_busy()
  * \param	data			Pointer to data buffer
  * \param	data_length		Size of data buffer (max 64 bytes)
  * \return					0
  */
 int si443x_transmit(uint8_t *data, uint8_t data_length);
 
+/*! Transmit a packet written byte by byte straight into the TX FIFO:
+ * si443x_tx_begin() opens the FIFO write burst, si443x_tx_put() writes a
+ * byte (up to 64 bytes), si443x_tx_commit() closes the burst and starts
+ * the transmitter.  Nothing else may use the SPI bus until si443x_tx_busy()
+ * returns 0, the background receiver is stopped and must be restarted
+ * afterwards.
+ */
+void si443x_tx_begin(void);
+void si443x_tx_put(uint8_t byte);
+int si443x_tx_commit(void);
+
+/*! Supplies the next byte of a streamed transmission, returns 0 when there
+ * is no more data.  Called from the nIRQ interrupt. */
+typedef uint8_t (*si443x_tx_source_t)(uint8_t *byte);
+
+/*! Like si443x_tx_commit(), but the packet continues with the bytes of the
+ * source, which may be longer than the FIFO.  The FIFO is refilled from
+ * the almost empty interrupt, the transmitter stays on throughout.
+ */
+int si443x_tx_commit_stream(si443x_tx_source_t source);
+
+/*! Nonzero while a packet is being sent, cleared by the nIRQ interrupt */
+uint8_t si443x_tx_busy(void);
+
+/*! Number of streamed transmissions cut short because the FIFO ran dry
+ * before the refill (interrupts held off too long) */
+uint16_t si443x_tx_underruns(void);
+
 /*! Dump registers */
 void si443x_dump(void);
 
@@ -1,4 +1,5 @@
-#include <util/delay.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
 #include <stdint.h>
 
 #include "common.h"
@@ -59,22 +60,50 @@ void temp_init(void)
 
 
 
+/*
+   Measurement state: the request flag is set from the tick interrupt, too,
+   the conversion runs and completes in temp_task()
+*/
+static volatile uint8_t g_temp_requested = 0;
+static uint8_t g_temp_converting = 0;
+static volatile int16_t g_temp_snapshot_t10 = TEMP_NA;
+
 /*
    Request measurement of all available temp devices readings to the console
+   (only sets the flag, safe in the interrupt)
 */
 
 void temp_request_start(void) 
 {
-	// si443x has no such feature
-	dallas_temp_request();
+	g_temp_requested = 1;
 }
 
 /*
-   Wait for all requested measurements
+   Start the requested conversion, print the readings when it is complete
+   and publish the snapshot.  Called repeatedly from the main loop.
 */
-void temp_request_wait(void) 
+void temp_task(void)
 {
-    _delay_ms(750);  
+  uint8_t sreg;
+  int16_t t10;
+
+  if (!g_temp_converting) {
+    if (!g_temp_requested)
+      return;
+    g_temp_requested = 0;
+    // si443x has no such feature
+    dallas_temp_request();
+    g_temp_converting = 1;
+    return;
+  }
+  if (!dallas_temp_ready())
+    return;
+  g_temp_converting = 0;
+  t10 = temp_request_print();
+  sreg = SREG;
+  cli();
+  g_temp_snapshot_t10 = t10;
+  SREG = sreg;
 }
 
 /*
@@ -90,19 +119,14 @@ int16_t temp_request_print(void)
 
 
 /*
-   Safely print all available temp devices readings to the console (blocking wait)
+   Print all available temp devices readings to the console, the readings
+   follow once temp_task() has them
 */
 
 void temp_print(void) 
 {
   // TODO: Use m328 reading if Dallas not available?
-  //DPRINTF("Temp request\n");
   temp_request_start();
-  //DPRINTF("Temp delay\n");
-  temp_request_wait();
-  //DPRINTF("Temp ready to print\n");
-  temp_request_print();
-  return 0;
 }
 
 /*
@@ -114,6 +138,20 @@ int16_t temp_get_last_known_t10(void) {
   T10m328 = (int16_t)(m328_read_Temp()/1000);
   if (T10dallas != TEMP_NA) return (T10dallas<T10m328 ? T10dallas : T10m328); else return T10m328;
   }
+
+/*
+ * Return the temp of the last completed measurement without touching the
+ * sensors (safe in the interrupt), TEMP_NA before the first one
+ */
+int16_t temp_get_snapshot_t10(void) {
+  uint8_t sreg = SREG;
+  int16_t t10;
+
+  cli();
+  t10 = g_temp_snapshot_t10;
+  SREG = sreg;
+  return t10;
+}
  
 /*
 
@@ -122,6 +160,10 @@ For every temperature sensor interface, following functions must be defined:
 uint8_t <dev>_temp_init() - initializes the sensing intrface & all devices, returns number of present sensors
 int16_t <dev>_temp_print() - prints the measurements to the console, returns the last measured temperature*10
 
+Sensors with a conversion time also define
+void <dev>_temp_request() - starts the conversion and returns
+uint8_t <dev>_temp_ready() - returns non-zero once the conversion is complete
+
 We have implemented the devices bellow.
 
 RFM 22/23 onchip si443x sensor temperature:
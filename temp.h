@@ -16,12 +16,12 @@ extern "C" {
 
 void temp_init(void);
 
-/* non-blocking measurements */
+/* non-blocking measurements, temp_task() is called from the main loop */
 void temp_request_start(void);
-void temp_request_wait(void);
+void temp_task(void);
 int16_t temp_request_print(void);
 
-/* blocking simple measurement */
+/* simple measurement, printed by temp_task() */
 void temp_print(void);
 
 /* print temp value */
@@ -30,6 +30,7 @@ void temp_print_value_long(long tn, long e);
 
 /* last measurement data */
 int16_t temp_get_last_known_t10(void);
+int16_t temp_get_snapshot_t10(void);
 
 #ifdef __cplusplus /* If this is a C++ compiler, use C linkage */
 }
@@ -0,0 +1,77 @@
+/*
+* Copyright 2013 Hynek Baran
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/*
+* Binary telemetry framing, see tlm.h
+*/
+
+#include <avr/io.h>
+#include <util/crc16.h>
+#include <stdint.h>
+
+#include "debug.h"
+#include "tlm.h"
+
+static volatile uint8_t g_tlm_enabled;
+
+void tlm_enable(uint8_t on)
+{
+  g_tlm_enabled = on;
+}
+
+uint8_t tlm_is_enabled(void)
+{
+  return g_tlm_enabled;
+}
+
+/* Send one byte of a frame, escaping the framing characters */
+static void tlm_put(uint8_t c)
+{
+  if (c == TLM_STX || c == TLM_ETX || c == TLM_DLE) {
+    debug_putc(TLM_DLE);
+    c ^= TLM_ESC_XOR;
+  }
+  debug_putc(c);
+}
+
+void tlm_send(uint8_t type, const void *payload, uint8_t len)
+{
+  const uint8_t *p = payload;
+  uint8_t crc = _crc_ibutton_update(0, type);
+
+  /* Frames are sent from the main loop only (the interrupt handlers record
+     events, fht_log_task() sends them), so nothing else writes in between.
+     Interrupts stay on: a full UART ring waits for the UART interrupt, and
+     the radio interrupt keeps its FIFO filled meanwhile. */
+  debug_putc(TLM_STX);
+  tlm_put(type);
+  while (len--) {
+    crc = _crc_ibutton_update(crc, *p);
+    tlm_put(*p++);
+  }
+  tlm_put(crc);
+  debug_putc(TLM_ETX);
+}
+
+void tlm_temp(uint8_t dev_type, uint8_t dev_index, int16_t t10)
+{
+  tlm_temp_t t;
+
+  t.dev_type = dev_type;
+  t.dev_index = dev_index;
+  t.t10 = t10;
+  tlm_send(TLM_TEMP, &t, sizeof(t));
+}
@@ -0,0 +1,149 @@
+/*
+* Copyright 2013 Hynek Baran
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/*
+* Binary telemetry.
+*
+* When enabled (CLI "tlm on"), the FHT, RX and temperature events are sent
+* as binary frames instead of the text LOG/MSG lines, everything else
+* (CLI replies, diagnostics) stays text on the same serial link.
+*
+* Frame: STX type payload... crc ETX
+*   - crc is the Dallas/Maxim CRC8 (_crc_ibutton_update) of type and payload
+*   - type, payload and crc bytes equal to STX, ETX or DLE are sent as
+*     DLE followed by the byte XOR TLM_ESC_XOR, so STX and ETX never occur
+*     inside a frame and never in the text, either
+*   - multi-byte payload fields are little endian
+*
+* The payload layouts below are shared with the host decoder in host/.
+*/
+
+#ifndef TLM_H_
+#define TLM_H_
+
+#include <stdint.h>
+
+#define TLM_STX			0x02
+#define TLM_ETX			0x03
+#define TLM_DLE			0x10
+#define TLM_ESC_XOR		0x20
+
+/*! Frame types */
+#define TLM_FHT_TX		0x01	/* message transmitted (LOG FHT 0 RFM_TX) */
+#define TLM_FHT_TQ		0x02	/* command enqueued (LOG FHT 0 RFM_TQ[_DROP]) */
+#define TLM_FHT_RX		0x03	/* message received (MSG FHT RX) */
+#define TLM_TEMP		0x04	/* temperature reading (MSG TMP) */
+#define TLM_VCC			0x05	/* supply voltage (MSG VCC) */
+#define TLM_FREEZE		0x06	/* freezing protection (LOG FHT 0 FREEZING) */
+#define TLM_FHT_SETALL	0x07	/* all groups set at once (LOG FHT 0 RFM_TQ_ALL) */
+#define TLM_FHT_SYNC	0x08	/* sync state (LOG FHT RFM_TX SYNC START/PROGRESS/DONE) */
+
+/*! Sensor types of TLM_TEMP and TLM_VCC */
+#define TLM_DEV_M328	0
+#define TLM_DEV_SI443	1
+#define TLM_DEV_DS18X20	2
+
+/*! TLM_FHT_SYNC events */
+#define TLM_SYNC_START		0
+#define TLM_SYNC_PROGRESS	1
+#define TLM_SYNC_DONE		2
+
+/*! TLM_FREEZE events */
+#define TLM_FREEZE_ENTER	0
+#define TLM_FREEZE_LEAVE	1
+#define TLM_FREEZE_ENFORCE	2
+
+typedef struct {
+  uint8_t group;
+  uint8_t hc1;
+  uint8_t hc2;
+  uint8_t address;
+  uint8_t command;
+  uint8_t extension;
+  uint16_t tick;
+} __attribute__((packed)) tlm_fht_tx_t;
+
+typedef struct {
+  uint8_t group;
+  uint8_t address;
+  uint8_t command;
+  uint8_t extension;
+  uint8_t dropped;              /* 1 if the command queue was full */
+  uint8_t pending;              /* commands waiting behind the current one */
+  uint16_t tick;
+} __attribute__((packed)) tlm_fht_tq_t;
+
+typedef struct {
+  uint8_t hc1;
+  uint8_t hc2;
+  uint8_t address;
+  uint8_t command;
+  uint8_t extension;
+  int8_t rssi;
+} __attribute__((packed)) tlm_fht_rx_t;
+
+typedef struct {
+  uint8_t dev_type;
+  uint8_t dev_index;
+  int16_t t10;                  /* 10 * temperature in C, TEMP_NA if unknown */
+} __attribute__((packed)) tlm_temp_t;
+
+typedef struct {
+  uint8_t dev_type;
+  uint16_t mv;
+} __attribute__((packed)) tlm_vcc_t;
+
+typedef struct {
+  uint8_t event;
+  uint8_t group;
+  int16_t t10;
+  uint16_t tick;
+} __attribute__((packed)) tlm_freeze_t;
+
+typedef struct {
+  uint8_t event;
+  uint8_t group;
+  uint8_t count;                /* sync countdown, 0 when done */
+  uint16_t tick;
+} __attribute__((packed)) tlm_fht_sync_t;
+
+/* Followed by the valve position of each group and a bitmap of the groups
+   whose command was not enqueued, the queue was full (bit 0 of the first
+   byte is group 1, (groups + 7) / 8 bytes) */
+typedef struct {
+  uint16_t tick;
+  uint8_t groups;
+} __attribute__((packed)) tlm_fht_setall_t;
+
+#ifdef __cplusplus /* If this is a C++ compiler, use C linkage */
+extern "C" {
+#endif
+
+/*! Select binary (1) or text (0) output of the events */
+void tlm_enable(uint8_t on);
+uint8_t tlm_is_enabled(void);
+
+/*! Send one frame to the debug UART */
+void tlm_send(uint8_t type, const void *payload, uint8_t len);
+
+/*! TLM_TEMP frame, for the sensor drivers */
+void tlm_temp(uint8_t dev_type, uint8_t dev_index, int16_t t10);
+
+#ifdef __cplusplus /* If this is a C++ compiler, use C linkage */
+}
+#endif
+
+#endif /* TLM_H_ */